@@ -0,0 +1,291 @@
+#include <rmv.hpp>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/wait.h>
+#include <functional>
+#include <sys/resource.h>
+
+/**
+ * Benchmark of rpmv against std::vector and std::deque.
+ *
+ * Every case runs in its own child process, so the peak RSS of a
+ * case is not hidden by the cases before it. The allocation counts
+ * and the heap peak come from the replaced global operator new and
+ * cover only the timed operation, the RSS covers the whole case.
+ *
+ * usage: bench [--json] [n]
+ */
+namespace rmvbench {
+
+using namespace std;
+using namespace chrono;
+
+struct heap {
+  // every block is prefixed with its size, the prefix keeps the
+  // alignment of the block
+  static constexpr size_t head = alignof(max_align_t);
+
+  // the counters are shared by the threads of the parallel sorts
+  inline static atomic<size_t> allocs = 0;
+  inline static atomic<size_t> frees = 0;
+  inline static atomic<size_t> live = 0;
+  inline static atomic<size_t> peak = 0;
+
+  static void reset(void) {
+    allocs = frees = 0;
+    peak = live.load();
+  }
+
+  static void* alloc(size_t n, size_t align = head) {
+    auto pre = std::max(head, align);
+    auto size = (n+pre+align-1)/align*align;
+    auto p = static_cast<char*>(align<=head ? std::malloc(size) :
+      std::aligned_alloc(align, size));
+    if( p==nullptr )
+      throw bad_alloc();
+    *reinterpret_cast<size_t*>(p) = n;
+    allocs.fetch_add(1, memory_order_relaxed);
+    auto now = live.fetch_add(n, memory_order_relaxed)+n;
+    auto top = peak.load(memory_order_relaxed);
+    while( top<now && !peak.compare_exchange_weak(top, now,
+        memory_order_relaxed) ) {}
+    return p+pre;
+  }
+
+  static void dlloc(void* p, size_t align = head) noexcept {
+    if( p==nullptr )
+      return;
+    auto base = static_cast<char*>(p)-std::max(head, align);
+    frees.fetch_add(1, memory_order_relaxed);
+    live.fetch_sub(*reinterpret_cast<size_t*>(base),
+      memory_order_relaxed);
+    std::free(base);
+  }
+};
+
+struct result {
+  double ns;
+  long rss;
+  size_t allocs;
+  size_t frees;
+  size_t peak;
+};
+
+template <class C>
+struct cont {
+  static void grow(C& c, size_t n) { c.resize(c.size()+n); }
+  static void shrink(C& c, size_t n) { c.resize(c.size()-n); }
+  static void sort(C& c) { std::sort(c.begin(), c.end()); }
+};
+
+template <uint8_t Exp, class Tp>
+struct cont<rsfr::rpmv<Exp, Tp>> {
+  using C = rsfr::rpmv<Exp, Tp>;
+  static void grow(C& c, size_t n) { c.fill(n); }
+  static void shrink(C& c, size_t n) { c.reduce(n); }
+  static void sort(C& c) { rsfr::sort(c); }
+};
+
+template <class Tp>
+Tp make(uint64_t x) {
+  if constexpr( is_same_v<Tp, string> )
+    return "key-"+to_string(x);
+  else
+    return static_cast<Tp>(x);
+}
+
+template <class C>
+void load(C& c, size_t n, uint64_t seed) {
+  using Tp = typename C::value_type;
+  mt19937_64 rng(seed);
+  for(size_t i=0; i<n; ++i)
+    c.push_back(make<Tp>(rng()));
+}
+
+template <class Tp>
+void sink(const Tp& x) {
+  if constexpr( is_same_v<Tp, string> )
+    asm volatile("" : : "r"(x.data()) : "memory");
+  else
+    asm volatile("" : : "g"(x) : "memory");
+}
+
+// run op on a prepared container, time and count it
+template <class C>
+result measure(size_t n, const string& op) {
+  C c;
+  vector<size_t> idx;
+  if( op!="push_back" && op!="fill" )
+    load(c, n, 1);
+  if( op=="random_at" ) {
+    mt19937_64 rng(2);
+    idx.resize(n);
+    for(auto& i : idx)
+      i = rng()%n;
+  }
+
+  heap::reset();
+  auto a = steady_clock::now();
+  if( op=="push_back" ) {
+    load(c, n, 1);
+  } else if( op=="pop_back" ) {
+    for(size_t i=0; i<n; ++i)
+      c.pop_back();
+  } else if( op=="scan" ) {
+    for(size_t i=0; i<n; ++i)
+      sink(c[i]);
+  } else if( op=="random_at" ) {
+    for(auto i : idx)
+      sink(c[i]);
+  } else if( op=="iterate" ) {
+    for(const auto& x : c)
+      sink(x);
+  } else if( op=="fill" ) {
+    cont<C>::grow(c, n);
+  } else if( op=="reduce" ) {
+    cont<C>::shrink(c, n);
+  } else if( op=="sort" ) {
+    cont<C>::sort(c);
+  }
+  auto b = steady_clock::now();
+
+  result res{};
+  res.ns = static_cast<double>(duration_cast<nanoseconds>(b-a)
+    .count())/static_cast<double>(n);
+  res.allocs = heap::allocs.load();
+  res.frees = heap::frees.load();
+  res.peak = heap::peak.load();
+  rusage ru{};
+  getrusage(RUSAGE_SELF, &ru);
+  res.rss = ru.ru_maxrss;
+  return res;
+}
+
+// run measure in a child process
+template <class C>
+bool isolate(size_t n, const string& op, result& res) {
+  int fd[2];
+  if( pipe(fd)!=0 )
+    return false;
+  auto pid = fork();
+  if( pid<0 )
+    return false;
+  if( pid==0 ) {
+    close(fd[0]);
+    auto r = measure<C>(n, op);
+    auto w = write(fd[1], &r, sizeof(r));
+    _exit(w==sizeof(r) ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(fd[1]);
+  auto r = read(fd[0], &res, sizeof(res));
+  close(fd[0]);
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return r==sizeof(res) && WIFEXITED(status) &&
+    WEXITSTATUS(status)==EXIT_SUCCESS;
+}
+
+const char* ops[] = { "push_back", "pop_back", "scan", "random_at",
+  "iterate", "fill", "reduce", "sort" };
+
+bool json = false;
+bool first = true;
+
+void report(const char* cname, int exp, const char* tname,
+  const char* op, size_t n, const result& r) {
+  if( json ) {
+    printf("%s\n  {\"container\": \"%s\", \"exp\": %d, "
+      "\"type\": \"%s\", \"op\": \"%s\", \"n\": %zu, "
+      "\"ns_per_op\": %.3f, \"peak_rss_kb\": %ld, "
+      "\"allocs\": %zu, \"frees\": %zu, \"peak_heap\": %zu}",
+      first ? "" : ",", cname, exp, tname, op, n, r.ns, r.rss,
+      r.allocs, r.frees, r.peak);
+  } else {
+    printf("%s,%d,%s,%s,%zu,%.3f,%ld,%zu,%zu,%zu\n", cname, exp,
+      tname, op, n, r.ns, r.rss, r.allocs, r.frees, r.peak);
+  }
+  first = false;
+}
+
+template <class C>
+void run(const char* cname, int exp, const char* tname, size_t n) {
+  for(auto op : ops) {
+    result r;
+    if( isolate<C>(n, op, r) )
+      report(cname, exp, tname, op, n, r);
+    else
+      fprintf(stderr, "%s/%d/%s/%s failed\n", cname, exp, tname, op);
+  }
+}
+
+template <class Tp>
+void run_type(const char* tname, size_t n) {
+  run<vector<Tp>>("vector", 0, tname, n);
+  run<deque<Tp>>("deque", 0, tname, n);
+  run<rsfr::rpmv<4, Tp>>("rpmv", 4, tname, n);
+  run<rsfr::rpmv<8, Tp>>("rpmv", 8, tname, n);
+  run<rsfr::rpmv<12, Tp>>("rpmv", 12, tname, n);
+  run<rsfr::rpmv<16, Tp>>("rpmv", 16, tname, n);
+}
+
+}
+
+void* operator new(std::size_t n) { return rmvbench::heap::alloc(n); }
+void* operator new[](std::size_t n) { return rmvbench::heap::alloc(n); }
+void operator delete(void* p) noexcept { rmvbench::heap::dlloc(p); }
+void operator delete[](void* p) noexcept { rmvbench::heap::dlloc(p); }
+void operator delete(void* p, std::size_t) noexcept
+  { rmvbench::heap::dlloc(p); }
+void operator delete[](void* p, std::size_t) noexcept
+  { rmvbench::heap::dlloc(p); }
+
+// over-aligned blocks are counted too
+void* operator new(std::size_t n, std::align_val_t al)
+  { return rmvbench::heap::alloc(n, static_cast<std::size_t>(al)); }
+void* operator new[](std::size_t n, std::align_val_t al)
+  { return rmvbench::heap::alloc(n, static_cast<std::size_t>(al)); }
+void operator delete(void* p, std::align_val_t al) noexcept
+  { rmvbench::heap::dlloc(p, static_cast<std::size_t>(al)); }
+void operator delete[](void* p, std::align_val_t al) noexcept
+  { rmvbench::heap::dlloc(p, static_cast<std::size_t>(al)); }
+void operator delete(void* p, std::size_t, std::align_val_t al) noexcept
+  { rmvbench::heap::dlloc(p, static_cast<std::size_t>(al)); }
+void operator delete[](void* p, std::size_t, std::align_val_t al) noexcept
+  { rmvbench::heap::dlloc(p, static_cast<std::size_t>(al)); }
+
+int main(int argc, char** argv) {
+  std::size_t n = 1<<20;
+  for(int i=1; i<argc; ++i) {
+    if( std::strcmp(argv[i], "--json")==0 )
+      rmvbench::json = true;
+    else
+      n = std::strtoull(argv[i], nullptr, 10);
+  }
+  if( n==0 ) {
+    std::fprintf(stderr, "usage: %s [--json] [n]\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if( rmvbench::json )
+    std::printf("[");
+  else
+    std::printf("container,exp,type,op,n,ns_per_op,peak_rss_kb,"
+      "allocs,frees,peak_heap\n");
+  std::fflush(stdout);
+  rmvbench::run_type<std::uint32_t>("uint32", n);
+  rmvbench::run_type<std::uint64_t>("uint64", n);
+  rmvbench::run_type<double>("double", n);
+  rmvbench::run_type<std::string>("string", n/4);
+  if( rmvbench::json )
+    std::printf("\n]\n");
+  return EXIT_SUCCESS;
+}
@@ -6,12 +6,7 @@
 #include <string>
 #include <vector>
 #include <algorithm>
-
-#if defined(__GNUG__) && defined(_OPENMP)
-# include <parallel/algorithm>
-#elif defined(_MSC_VER)
-# include <execution>
-#endif
+#include <functional>
 
 namespace rmvmain {
 
@@ -58,11 +53,7 @@ void run(void) {
   mv.push_back(333);
 
   cl.start();
-#if defined(__GNUG__) && defined(_OPENMP)
-  __gnu_parallel::stable_sort(mv.rbegin(), mv.rend());
-#elif defined(_MSC_VER)
-  stable_sort(execution::par, mv.rbegin(), mv.rend());
-#endif
+  rsfr::stable_sort(mv, greater<>());
   cout<<"clock = "<<cl.result<milliseconds>()<<" ms"<<endl<<endl;
   mv.print();
 
@@ -71,9 +62,38 @@ void run(void) {
   cout<<endl<<endl;
 }
 
+// par over a double-ended vector whose elements don't start at a
+// block boundary
+bool both_ends(void) {
+  rsfr::rdmv<3, int> dv;
+  for(int i=0; i<5; ++i)
+    dv.push_front(1);
+  for(int i=0; i<100; ++i)
+    dv.push_back(1);
+  auto count = rsfr::par::count_if(dv, [](int x) { return x==1; });
+  auto sum = rsfr::par::reduce(dv, 0);
+  cout<<"count = "<<count<<", sum = "<<sum<<", size = "<<dv.size()<<endl;
+  return count==dv.size() && static_cast<size_t>(sum)==dv.size();
+}
+
+// a walk of a concurrent vector begun while it was empty
+bool appended(void) {
+  rsfr::concurrent_rpmv<4, int> log;
+  auto first = log.begin();
+  log.push_back(41);
+  log.push_back(1);
+  auto sum = 0;
+  for(auto it=first; it!=log.end(); ++it)
+    sum += *it;
+  cout<<"sum = "<<sum<<", size = "<<log.size()<<endl;
+  return sum==42;
+}
+
 }
 
 int main(void) {
   rmvmain::run();
-  return EXIT_SUCCESS;
+  auto ok = rmvmain::both_ends();
+  ok = rmvmain::appended() && ok;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -30,16 +30,114 @@
 #ifndef RSFR_RMV_H
 #define RSFR_RMV_H
 
+#include <bit>
+#include <new>
+#include <span>
+#include <ranges>
+#include <atomic>
 #include <limits>
+#include <memory>
+#include <vector>
 #include <cstdint>
+#include <cstring>
+#include <utility>
+#include <fstream>
+#include <optional>
+#include <iterator>
 #include <iostream>
+#include <algorithm>
 #include <functional>
+#include <stdexcept>
 #include <type_traits>
+#include <system_error>
+#include <memory_resource>
 #include <initializer_list>
 
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define RSFR_RMV_MMAP
+#endif
+
+#if defined(__GNUC__)
+#define RSFR_RMV_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define RSFR_RMV_PREFETCH(p) ((void)(p))
+#endif
+
+// OpenMP directive, nothing when built without OpenMP
+#if defined(_OPENMP) && defined(_MSC_VER)
+#define RSFR_RMV_OMP(x) __pragma(x)
+#elif defined(_OPENMP)
+#define RSFR_RMV_OMP(x) _Pragma(#x)
+#else
+#define RSFR_RMV_OMP(x)
+#endif
+
 namespace rsfr {
 
-template <std::uint8_t Exp, class Tp>
+/**
+ * Default traits of multilevel vector.
+ * 
+ * Derive from it and override members to tune the vector,
+ * e.g. struct hot : mvtraits { static constexpr ... };
+ */
+struct mvtraits {
+  // num of sets of the block cache, zero disables the cache,
+  // a cached vector must not be read by several threads at once
+  static constexpr std::size_t cache_sets = 0;
+  // num of blocks in each set of the block cache
+  static constexpr std::size_t cache_ways = 1;
+  // num of blocks carved from each slab of the block pool,
+  // zero disables the pool
+  static constexpr std::size_t pool_slab = 0;
+  // num of free blocks the block pool keeps before it returns
+  // empty slabs
+  static constexpr std::size_t pool_retain = 64;
+  // slabs of the block pool are mmap regions advised to use
+  // transparent huge pages, rounded up to whole huge pages,
+  // requires pool_slab, falls back to the allocator without mmap
+  static constexpr bool pool_mmap = false;
+  // exponent of the size of block of index, zero uses the
+  // exponent of block of value
+  static constexpr std::uint8_t index_exponent = 0;
+  // blocks are reference counted and shared by copies, a write
+  // clones the shared blocks on its path, excludes pool_slab,
+  // a copy invalidates the references for writing of the source
+  static constexpr bool cow = false;
+  // num of elements held inside the vector object, they serve as
+  // the block of value of root until the size passes them, then
+  // move once into a block from the allocator, zero disables it,
+  // below the size of block of value, excludes cow
+  static constexpr std::size_t inline_size = 0;
+  // exponent of the smallest block of value, while the tree is a
+  // single block its size starts here and doubles up to the size
+  // of block of value, zero disables the tiers, excludes cow
+  static constexpr std::uint8_t tier_exponent = 0;
+  // the vector can be opened from a file by open_mapped(), it
+  // keeps the mapping inside the vector object, excludes cow
+  static constexpr bool file_map = false;
+};
+
+/**
+ * Exponent of block of value which fits Bytes, a page by default,
+ * e.g. rpmv<leaf_exponent<int>, int>, which rpmv_auto<int> spells
+ * for the page. Use a multiple of the cache line size to fit a set
+ * num of lines instead. Exp stays the first parameter of rpmv, so
+ * the default lives in the _auto aliases rather than in rpmv.
+ */
+template <class Tp, std::size_t Bytes = 4096>
+inline constexpr std::uint8_t leaf_exponent = [] {
+  std::uint8_t exp = 1;
+  while( (sizeof(Tp)<<(exp+1))<=Bytes )
+    ++exp;
+  return exp;
+}();
+
+template <std::uint8_t Exp, class Tp, class Traits = mvtraits,
+  class Alloc = std::allocator<Tp>>
 struct mvb {
   using value_type = Tp;
   using reference = Tp&;
@@ -58,64 +156,623 @@ struct mvb {
     std::numeric_limits<difference_type>::digits==
     std::numeric_limits<std::int64_t>::digits,
     std::int32_t, std::int16_t>;
+  using val_alloc = typename std::allocator_traits<Alloc>::
+    template rebind_alloc<Tp>;
+  using index_alloc = typename std::allocator_traits<Alloc>::
+    template rebind_alloc<Tp*>;
+  using val_traits = std::allocator_traits<val_alloc>;
+  using index_traits = std::allocator_traits<index_alloc>;
 
-  template <class Blk>
-  static void dlloc(Blk block)
-    noexcept(std::is_nothrow_destructible_v<
-      std::remove_pointer_t<Blk>>)
-    { delete[] block; }
+  static_assert(std::is_same_v<typename val_traits::pointer, Tp*>,
+    "allocator with fancy pointer is not supported");
 
+  // the allocator doesn't customize the construction, so the
+  // elements may be built by the plain algorithms
+  static constexpr bool plain =
+    std::is_same_v<val_alloc, std::allocator<Tp>> ||
+    (std::is_same_v<val_alloc, std::pmr::polymorphic_allocator<Tp>> &&
+      !std::uses_allocator_v<Tp, std::pmr::polymorphic_allocator<Tp>>);
+
+  // block of value is raw storage, the elements are
+  // constructed and destroyed by the vector
   struct val {
-    static Tp* alloc(void)
-      { return new Tp[size()]; }
-    static Tp* alloc(const Tp& val) {
-      auto block = new Tp[size()];
-      std::fill_n(block, size(), val);
+    static Tp* alloc(val_alloc& alloc)
+      { return val_traits::allocate(alloc, size()); }
+    static void dlloc(val_alloc& alloc, Tp* block) noexcept
+      { val_traits::deallocate(alloc, block, size()); }
+  };
+
+  struct index {
+    static Tp** alloc(val_alloc& alloc) {
+      index_alloc ialloc(alloc);
+      auto block = index_traits::allocate(ialloc, isize());
+      std::uninitialized_fill_n(block, isize(), nullptr);
       return block;
     }
-    static Tp* alloc(mvbsize_type n)
-      { return new Tp[n]; }
-    static Tp* alloc(mvbsize_type n, const Tp& val) {
-      auto block = new Tp[n];
-      std::fill_n(block, n, val);
-      return block;
+    static void dlloc(val_alloc& alloc, Tp** block) noexcept {
+      index_alloc ialloc(alloc);
+      index_traits::deallocate(ialloc, block, isize());
     }
   };
 
-  struct index {
-    static Tp** alloc(void)
-      { return new Tp*[size()](); }
-    static Tp** alloc(mvbsize_type n)
-      { return new Tp*[n](); }
+  using refs_type = std::atomic<std::uint32_t>;
+
+  // block of copy-on-write vector, the reference count is put
+  // in front of the block, a new block has one reference
+  template <class Elm, std::size_t N>
+  struct shared {
+    static constexpr size_type align =
+      std::max(alignof(Elm), alignof(refs_type));
+    static constexpr size_type head =
+      (sizeof(refs_type)+alignof(Elm)-1)/alignof(Elm)*alignof(Elm);
+    static constexpr size_type units =
+      (head+sizeof(Elm)*N+align-1)/align;
+
+    struct alignas(align) unit {
+      std::byte bytes[align];
+    };
+
+    using unit_alloc = typename std::allocator_traits<Alloc>::
+      template rebind_alloc<unit>;
+    using unit_traits = std::allocator_traits<unit_alloc>;
+
+    static Elm* alloc(val_alloc& alloc) {
+      unit_alloc ualloc(alloc);
+      auto raw = reinterpret_cast<std::byte*>(
+        unit_traits::allocate(ualloc, units));
+      ::new(raw) refs_type(1);
+      return reinterpret_cast<Elm*>(raw+head);
+    }
+    static void dlloc(val_alloc& alloc, Elm* block) noexcept {
+      unit_alloc ualloc(alloc);
+      auto raw = reinterpret_cast<std::byte*>(block)-head;
+      refs(block).~refs_type();
+      unit_traits::deallocate(ualloc, reinterpret_cast<unit*>(raw),
+        units);
+    }
+    static refs_type& refs(Elm* block) noexcept {
+      return *std::launder(reinterpret_cast<refs_type*>(
+        reinterpret_cast<std::byte*>(block)-head));
+    }
   };
   
+  // exponent of block of index
+  static constexpr std::uint8_t IExp =
+    Traits::index_exponent==0 ? Exp : Traits::index_exponent;
+
+  static_assert(Exp>0 && IExp>0 &&
+    Exp<=std::numeric_limits<mvbsize_type>::digits-2 &&
+    IExp<=std::numeric_limits<mvbsize_type>::digits-2,
+    "exponent of block is out of range");
+
+  // size of block of value
   static consteval mvbsize_type
     size(void) noexcept
     { return static_cast<mvbsize_type>(1)<<Exp; }
   static consteval mvbsize_type
     mask(void) noexcept
     { return size()-1; }
+  // size of block of index
+  static consteval mvbsize_type
+    isize(void) noexcept
+    { return static_cast<mvbsize_type>(1)<<IExp; }
+  static consteval mvbsize_type
+    imask(void) noexcept
+    { return isize()-1; }
+  // num of bits below the level
+  static constexpr size_type
+    shift(mvlsize_type lvl) noexcept
+    { return lvl==0 ? 0 : Exp+IExp*(lvl-1); }
   static constexpr mvbsize_type
-    jump(mvlsize_type lvl, size_type i) noexcept
-    { return static_cast<mvbsize_type>(i&mask()<<Exp*lvl)>>Exp*lvl; }
+    jump(mvlsize_type lvl, size_type i) noexcept {
+    return static_cast<mvbsize_type>(i>>shift(lvl))&
+      (lvl==0 ? mask() : imask());
+  }
+  // height of the tree which holds every position below
+  // 2^(digits-2), the max size of the vectors
+  static consteval mvlsize_type
+    max_height(void) noexcept {
+    constexpr auto bits = std::numeric_limits<size_type>::digits-2;
+    return bits<=Exp ? 0 : (bits-Exp+IExp-1)/IExp;
+  }
+
+  // levels walked by unrolled code, the levels above are a loop
+  static constexpr mvlsize_type unroll_height =
+    std::min<mvlsize_type>(max_height(), 8);
+
+  /**
+   * @brief   Walk the levels of a path.
+   * 
+   * Calls step(lvl) from lvl deep down to Stop+1. The lowest
+   * unroll_height levels are unrolled for every height, with lvl
+   * as std::integral_constant, so the walk is a fixed chain of
+   * loads with constant shifts entered by a single jump.
+   * 
+   * @param   deep   Height of the tree
+   * @param   step   step(lvl), lvl converts to mvlsize_type
+   */
+  template <mvlsize_type Stop = 0, class Step>
+  static void descend(mvlsize_type deep, Step&& step)
+    noexcept(std::is_nothrow_invocable_v<Step&, mvlsize_type>) {
+    for(; deep>unroll_height; --deep)
+      step(deep);
+    [&]<mvlsize_type... D>(std::integer_sequence<mvlsize_type, D...>) {
+      (void)((deep==D ? (levels<D, Stop>(step), true) : false) || ...);
+    }(std::make_integer_sequence<mvlsize_type, unroll_height+1>{});
+  }
+  template <mvlsize_type Lvl, mvlsize_type Stop, class Step>
+  static void levels(Step& step)
+    noexcept(std::is_nothrow_invocable_v<Step&, mvlsize_type>) {
+    if constexpr( Lvl>Stop ) {
+      step(std::integral_constant<mvlsize_type, Lvl>{});
+      levels<Lvl-1, Stop>(step);
+    }
+  }
+};
+
+/**
+ * Counters of a vector, kept only if RMV_STATS is defined before
+ * the header in every translation unit, otherwise they stay zero
+ * and the recording compiles to nothing.
+ */
+struct mvstats {
+  // blocks of value allocated and deallocated
+  std::size_t leaf_allocs;
+  std::size_t leaf_frees;
+  // blocks of index allocated and deallocated
+  std::size_t index_allocs;
+  std::size_t index_frees;
+  // levels added to and removed from the tree
+  std::size_t grows;
+  std::size_t shrinks;
+  // walks from the root down to a block of value
+  std::size_t descents;
+  // lookups of the block cache
+  std::size_t cache_hits;
+  std::size_t cache_misses;
+};
+
+/**
+ * Exact memory held by the blocks of a vector, in bytes as they
+ * are requested from the allocator, e.g. with the reference count
+ * of copy-on-write blocks.
+ */
+struct mvmemory {
+  std::size_t leaf_blocks;
+  std::size_t index_blocks;
+  std::size_t leaf_bytes;
+  std::size_t index_bytes;
+  // unused elements of the allocated blocks of value
+  std::size_t slack_bytes;
+  // file mapping of an opened vector, its blocks are counted
+  // above as well
+  std::size_t mapped_bytes;
+};
+
+#ifdef RMV_STATS
+inline constexpr bool mvstats_enabled = true;
+#else
+inline constexpr bool mvstats_enabled = false;
+#endif
+
+// the counters are relaxed atomics, as the const lookups count too
+template <bool On = mvstats_enabled>
+class mvrecord {
+  private:
+    mvstats m_stats{};
+
+  public:
+    void add(std::size_t mvstats::*counter, std::size_t n = 1)
+      noexcept {
+      std::atomic_ref<std::size_t>(m_stats.*counter)
+        .fetch_add(n, std::memory_order_relaxed);
+    }
+    mvstats get(void) const noexcept {
+      mvstats stats{};
+      for(auto counter : { &mvstats::leaf_allocs,
+          &mvstats::leaf_frees, &mvstats::index_allocs,
+          &mvstats::index_frees, &mvstats::grows, &mvstats::shrinks,
+          &mvstats::descents, &mvstats::cache_hits,
+          &mvstats::cache_misses })
+        stats.*counter = std::atomic_ref<std::size_t>(
+          const_cast<mvstats&>(m_stats).*counter)
+          .load(std::memory_order_relaxed);
+      return stats;
+    }
+    void reset(void) noexcept { m_stats = {}; }
+};
+
+template <>
+class mvrecord<false> {
+  public:
+    void add(std::size_t mvstats::*, std::size_t = 1) noexcept {}
+    mvstats get(void) const noexcept { return {}; }
+    void reset(void) noexcept {}
+};
+
+/**
+ * Set-associative cache of blocks of value.
+ * 
+ * Blocks are keyed by their number (i>>Exp), every set is kept in
+ * LRU order, so a hit on the first way doesn't write anything.
+ */
+template <class Tp, std::size_t Sets, std::size_t Ways>
+class mvcache {
+  static_assert(Sets>0 && (Sets&(Sets-1))==0,
+    "num of sets must be a power of two");
+  static_assert(Ways>0, "num of ways must be greater than zero");
+
+  private:
+    static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+
+    struct line {
+      std::size_t key;
+      Tp* block;
+    } m_set[Sets][Ways];
+
+  public:
+    mvcache(void) noexcept { clear(); }
+
+    Tp* find(std::size_t key) noexcept {
+      auto set = m_set[key&(Sets-1)];
+      if( set[0].key==key )
+        return set[0].block;
+      for(std::size_t i=1; i<Ways; ++i) {
+        if( set[i].key!=key )
+          continue;
+        // move to the front
+        auto hit = set[i];
+        std::move_backward(set, set+i, set+i+1);
+        set[0] = hit;
+        return hit.block;
+      }
+      return nullptr;
+    }
+
+    void insert(std::size_t key, Tp* block) noexcept {
+      auto set = m_set[key&(Sets-1)];
+      std::move_backward(set, set+Ways-1, set+Ways);
+      set[0] = {key, block};
+    }
+
+    void erase(std::size_t key) noexcept {
+      auto set = m_set[key&(Sets-1)];
+      for(std::size_t i=0; i<Ways; ++i) {
+        if( set[i].key!=key )
+          continue;
+        std::move(set+i+1, set+Ways, set+i);
+        set[Ways-1] = {npos, nullptr};
+        return;
+      }
+    }
+
+    void clear(void) noexcept
+      { std::fill_n(&m_set[0][0], Sets*Ways, line{npos, nullptr}); }
+};
+
+template <class Tp, std::size_t Ways>
+class mvcache<Tp, 0, Ways> {
+  public:
+    Tp* find(std::size_t) noexcept { return nullptr; }
+    void insert(std::size_t, Tp*) noexcept {}
+    void erase(std::size_t) noexcept {}
+    void clear(void) noexcept {}
+};
+
+/**
+ * Pool of fixed-size blocks.
+ * 
+ * Blocks are carved from slabs of Slab blocks and recycled through
+ * the free list of their slab. A slab goes back to the heap once
+ * all of its blocks are free and the pool keeps more than Retain
+ * free blocks.
+ * 
+ * Slabs come from the allocator of the owner, which is passed to
+ * each call, the owner must purge() the pool with it before the
+ * pool is destroyed. The header of a slab sits behind its blocks
+ * and the slabs are found through a directory sorted by address,
+ * which comes from the same allocator, so the pool never touches
+ * the global heap. If Map is set, slabs are mmap regions instead,
+ * aligned to and advised to use huge pages, so a walk of the tree
+ * touches few TLB entries. Regions grow one by one and go back
+ * with munmap, the same way as slabs.
+ */
+template <std::size_t Size, std::size_t Align,
+  std::size_t Slab, std::size_t Retain, bool Map = false>
+class mvpool {
+  private:
+    struct slab {
+      void* free;
+      std::size_t nfree;
+      slab* prev;
+      slab* next;
+    };
+
+    static constexpr std::size_t align =
+      std::max({Align, alignof(void*), alignof(slab)});
+    static constexpr std::size_t stride =
+      (std::max(Size, sizeof(void*))+align-1)/align*align;
+    static constexpr std::size_t head =
+      (sizeof(slab)+align-1)/align*align;
+#ifdef RSFR_RMV_MMAP
+    static constexpr bool map = Map;
+#else
+    static constexpr bool map = false;
+#endif
+    static constexpr std::size_t huge_page = std::size_t{1}<<21;
+    // a region takes whole huge pages and fills them with blocks
+    static constexpr std::size_t bytes = !map ? stride*Slab+head :
+      (stride*Slab+head+huge_page-1)/huge_page*huge_page;
+    // num of blocks of each slab
+    static constexpr std::size_t nslab = (bytes-head)/stride;
+
+    struct alignas(align) unit {
+      std::byte bytes[align];
+    };
+
+    template <class Alloc>
+    using unit_alloc = typename std::allocator_traits<Alloc>::
+      template rebind_alloc<unit>;
+    template <class Alloc>
+    using dir_alloc = typename std::allocator_traits<Alloc>::
+      template rebind_alloc<slab*>;
+
+    // slabs sorted by address
+    slab** m_dir;
+    std::size_t m_nslabs;
+    std::size_t m_cap;
+    slab* m_partial;
+    std::size_t m_nfree;
+
+  public:
+    mvpool(void) noexcept :
+      m_dir{}, m_nslabs{}, m_cap{}, m_partial{}, m_nfree{} {}
+    mvpool(const mvpool&) = delete;
+    mvpool& operator=(const mvpool&) = delete;
+
+    void swap(mvpool& other) noexcept {
+      std::swap(m_dir, other.m_dir);
+      std::swap(m_nslabs, other.m_nslabs);
+      std::swap(m_cap, other.m_cap);
+      std::swap(m_partial, other.m_partial);
+      std::swap(m_nfree, other.m_nfree);
+    }
+
+    template <class Alloc>
+    void* allocate(Alloc& alloc) {
+      if( m_partial==nullptr )
+        grow(alloc);
+      auto& slb = *m_partial;
+      auto block = slb.free;
+      slb.free = *std::launder(static_cast<void**>(block));
+      --m_nfree;
+      if( --slb.nfree==0 )
+        unlink(slb);
+      return block;
+    }
+
+    template <class Alloc>
+    void deallocate(Alloc& alloc, void* block) noexcept {
+      auto it = std::upper_bound(m_dir, m_dir+m_nslabs,
+        static_cast<std::byte*>(block), [](std::byte* p, slab* s) {
+          return p<base(s);
+        })-1;
+      auto& slb = **it;
+      ::new(block) void*(slb.free);
+      slb.free = block;
+      ++m_nfree;
+      if( slb.nfree++==0 )
+        link(slb);
+      // return the slab if all of its blocks are free
+      if( slb.nfree==nslab && m_nfree>Retain ) {
+        unlink(slb);
+        m_nfree -= nslab;
+        std::copy(it+1, m_dir+m_nslabs, it);
+        --m_nslabs;
+        release(alloc, &slb);
+      }
+    }
+
+    // return all slabs, all blocks must be free
+    template <class Alloc>
+    void purge(Alloc& alloc) noexcept {
+      for(std::size_t i=0; i<m_nslabs; ++i)
+        release(alloc, m_dir[i]);
+      if( m_dir!=nullptr ) {
+        dir_alloc<Alloc> dalloc(alloc);
+        std::allocator_traits<dir_alloc<Alloc>>::deallocate(dalloc,
+          m_dir, m_cap);
+      }
+      discard();
+    }
+
+    // forget all slabs and the directory without returning them
+    void discard(void) noexcept {
+      m_dir = nullptr;
+      m_nslabs = m_cap = 0;
+      m_partial = nullptr;
+      m_nfree = 0;
+    }
+
+  private:
+    static std::byte* base(slab* slb) noexcept {
+      return reinterpret_cast<std::byte*>(slb)-stride*nslab;
+    }
+
+    template <class Alloc>
+    void grow(Alloc& alloc) {
+      // the directory grows first, so a new slab can't be lost
+      if( m_nslabs==m_cap ) {
+        using dtraits = std::allocator_traits<dir_alloc<Alloc>>;
+        dir_alloc<Alloc> dalloc(alloc);
+        auto cap = std::max<std::size_t>(m_cap*2, 8);
+        auto dir = std::to_address(dtraits::allocate(dalloc, cap));
+        std::copy_n(m_dir, m_nslabs, dir);
+        if( m_dir!=nullptr )
+          dtraits::deallocate(dalloc, m_dir, m_cap);
+        m_dir = dir;
+        m_cap = cap;
+      }
+      std::byte* base;
+      if constexpr( map )
+        base = map_region();
+      else {
+        unit_alloc<Alloc> ualloc(alloc);
+        base = reinterpret_cast<std::byte*>(std::to_address(
+          std::allocator_traits<unit_alloc<Alloc>>::allocate(ualloc,
+            bytes/align)));
+      }
+      auto slb = ::new(base+stride*nslab)
+        slab{nullptr, nslab, nullptr, nullptr};
+      for(auto i=nslab; i>0; --i)
+        slb->free = ::new(base+(i-1)*stride) void*(slb->free);
+      auto it = std::upper_bound(m_dir, m_dir+m_nslabs, slb);
+      std::copy_backward(it, m_dir+m_nslabs, m_dir+m_nslabs+1);
+      *it = slb;
+      ++m_nslabs;
+      link(*slb);
+      m_nfree += nslab;
+    }
+
+    template <class Alloc>
+    static void release(Alloc& alloc, slab* slb) noexcept {
+      if constexpr( map ) {
+#ifdef RSFR_RMV_MMAP
+        ::munmap(base(slb), bytes);
+#endif
+      } else {
+        unit_alloc<Alloc> ualloc(alloc);
+        std::allocator_traits<unit_alloc<Alloc>>::deallocate(ualloc,
+          reinterpret_cast<unit*>(base(slb)), bytes/align);
+      }
+    }
+
+    /**
+     * Maps one huge page more than needed, then trims the head and
+     * the tail so the region starts at a huge page boundary. If
+     * the kernel can't give huge pages, normal pages are used.
+     */
+    static std::byte* map_region(void) {
+#ifdef RSFR_RMV_MMAP
+      auto raw = ::mmap(nullptr, bytes+huge_page, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+      if( raw==MAP_FAILED )
+        throw std::bad_alloc();
+      auto addr = reinterpret_cast<std::uintptr_t>(raw);
+      auto head = (huge_page-(addr&(huge_page-1)))&(huge_page-1);
+      auto base = static_cast<std::byte*>(raw)+head;
+      if( head!=0 )
+        ::munmap(raw, head);
+      ::munmap(base+bytes, huge_page-head);
+#ifdef MADV_HUGEPAGE
+      ::madvise(base, bytes, MADV_HUGEPAGE);
+#endif
+      return base;
+#else
+      throw std::bad_alloc();
+#endif
+    }
+
+    void link(slab& slb) noexcept {
+      slb.prev = nullptr;
+      slb.next = m_partial;
+      if( m_partial!=nullptr )
+        m_partial->prev = &slb;
+      m_partial = &slb;
+    }
+
+    void unlink(slab& slb) noexcept {
+      if( slb.prev!=nullptr )
+        slb.prev->next = slb.next;
+      else
+        m_partial = slb.next;
+      if( slb.next!=nullptr )
+        slb.next->prev = slb.prev;
+    }
+};
+
+template <std::size_t Size, std::size_t Align,
+  std::size_t Retain, bool Map>
+class mvpool<Size, Align, 0, Retain, Map> {
+  public:
+    void swap(mvpool&) noexcept {}
+    template <class Alloc>
+    void purge(Alloc&) noexcept {}
+    void discard(void) noexcept {}
+};
+
+/**
+ * Inline buffer of N elements inside the vector object, raw
+ * storage whose elements are constructed by the vector.
+ */
+template <class Tp, std::size_t N>
+class mvinline {
+  private:
+    alignas(Tp) std::byte m_bytes[sizeof(Tp)*N];
+
+  public:
+    Tp* data(void) noexcept
+      { return reinterpret_cast<Tp*>(m_bytes); }
+    const Tp* data(void) const noexcept
+      { return reinterpret_cast<const Tp*>(m_bytes); }
+};
+
+template <class Tp>
+class mvinline<Tp, 0> {
+  public:
+    Tp* data(void) noexcept { return nullptr; }
+    const Tp* data(void) const noexcept { return nullptr; }
+};
+
+/**
+ * File mapping which holds the blocks of an opened vector, empty
+ * unless Map is set.
+ */
+template <bool Map>
+struct mvmap {
+  std::byte* base = nullptr;
+  std::size_t len = 0;
+};
+
+template <>
+struct mvmap<false> {
+  static constexpr std::byte* base = nullptr;
+  static constexpr std::size_t len = 0;
 };
 
-template <std::uint8_t Exp, class Tp>
+template <std::uint8_t Exp, class Tp, class Traits, class Alloc>
 class mv {
   private:
-    using mvlsize_type = typename mvb<Exp, Tp>::mvlsize_type;
-    using mvldiff_type = typename mvb<Exp, Tp>::mvldiff_type;
-    using mvbsize_type = typename mvb<Exp, Tp>::mvbsize_type;
-    using mvbdiff_type = typename mvb<Exp, Tp>::mvbdiff_type;
+    using blk = mvb<Exp, Tp, Traits, Alloc>;
+    using val_traits = typename blk::val_traits;
+    using sval = typename blk::template shared<Tp, blk::size()>;
+    using sindex = typename blk::template shared<Tp*, blk::isize()>;
+
+    static_assert(!Traits::cow || Traits::pool_slab==0,
+      "shared blocks can't be taken from the block pool");
+    static_assert(Traits::inline_size<blk::size() &&
+      (!Traits::cow || Traits::inline_size==0),
+      "inline buffer must be smaller than a block and unshared");
+    static_assert(Traits::inline_size==0 ||
+      std::is_nothrow_move_constructible_v<Tp>,
+      "elements of inline buffer are moved by noexcept steal");
+    static_assert(Traits::tier_exponent<Exp &&
+      (!Traits::cow || Traits::tier_exponent==0),
+      "tiers must be smaller than a block and unshared");
+    using mvlsize_type = typename blk::mvlsize_type;
+    using mvldiff_type = typename blk::mvldiff_type;
+    using mvbsize_type = typename blk::mvbsize_type;
+    using mvbdiff_type = typename blk::mvbdiff_type;
 
   public:
-    using value_type = typename mvb<Exp, Tp>::value_type;
-    using reference = typename mvb<Exp, Tp>::reference;
-    using const_reference = typename mvb<Exp, Tp>::const_reference;
-    using pointer = typename mvb<Exp, Tp>::pointer;
-    using const_pointer = typename mvb<Exp, Tp>::const_pointer;
-    using size_type = typename mvb<Exp, Tp>::size_type;
-    using difference_type = typename mvb<Exp, Tp>::difference_type;
+    using value_type = typename blk::value_type;
+    using reference = typename blk::reference;
+    using const_reference = typename blk::const_reference;
+    using pointer = typename blk::pointer;
+    using const_pointer = typename blk::const_pointer;
+    using size_type = typename blk::size_type;
+    using difference_type = typename blk::difference_type;
+    using allocator_type = Alloc;
 
   protected:
     union mvp {
@@ -125,12 +782,116 @@ class mv {
     } m_root;
     size_type m_peek;
     mvlsize_type m_deep;
+    // exponent of the size of a tiered root block of value, zero
+    // if the root is a whole block or the inline buffer
+    mvlsize_type m_tier;
     mvbsize_type m_free;
+    Tp* m_tail;
+    [[no_unique_address]] mutable mvcache<Tp,
+      Traits::cache_sets, Traits::cache_ways> m_cache;
+    [[no_unique_address]] mutable mvrecord<> m_stats;
+    [[no_unique_address]] mvpool<sizeof(Tp)*blk::size(),
+      alignof(Tp), Traits::pool_slab, Traits::pool_retain,
+      Traits::pool_mmap> m_vpool;
+    [[no_unique_address]] mvpool<sizeof(Tp*)*blk::isize(),
+      alignof(Tp*), Traits::pool_slab, Traits::pool_retain,
+      Traits::pool_mmap> m_ipool;
+    [[no_unique_address]] typename blk::val_alloc m_alloc;
+    [[no_unique_address]] mvmap<Traits::file_map> m_map;
+    [[no_unique_address]] mvinline<Tp, Traits::inline_size> m_inline;
 
-    mv(void) noexcept : m_root{}, m_peek{}, m_deep{}, m_free{} {}
-    // ~mv(void) noexcept(std::is_nothrow_destructible_v<Tp>) { destroy(); }
+    explicit mv(const Alloc& alloc) noexcept :
+      m_root{}, m_peek{}, m_deep{}, m_tier{}, m_free{}, m_tail{},
+      m_alloc(alloc), m_map{} {}
+    // the vector must be destroyed or discarded before
+    ~mv(void) noexcept { purge(); }
 
   private:
+    /**
+     * Blocks are taken from and returned to the block pool when
+     * it is enabled by the traits, otherwise to the allocator.
+     */
+    Tp* alloc_val(void) {
+      Tp* block;
+      if constexpr( Traits::cow )
+        block = sval::alloc(m_alloc);
+      else if constexpr( Traits::pool_slab==0 )
+        block = blk::val::alloc(m_alloc);
+      else
+        block = static_cast<Tp*>(m_vpool.allocate(m_alloc));
+      m_stats.add(&mvstats::leaf_allocs);
+      return block;
+    }
+
+    Tp** alloc_index(void) {
+      Tp** block;
+      if constexpr( Traits::cow ) {
+        block = sindex::alloc(m_alloc);
+        std::uninitialized_fill_n(block, blk::isize(), nullptr);
+      } else if constexpr( Traits::pool_slab==0 )
+        block = blk::index::alloc(m_alloc);
+      else {
+        block = static_cast<Tp**>(m_ipool.allocate(m_alloc));
+        std::uninitialized_fill_n(block, blk::isize(), nullptr);
+      }
+      m_stats.add(&mvstats::index_allocs);
+      return block;
+    }
+
+    // blocks of the file mapping are never deallocated
+    bool mapped(const void* block) const noexcept {
+      if constexpr( !Traits::file_map )
+        return false;
+      else {
+        auto addr = reinterpret_cast<std::uintptr_t>(block);
+        auto base = reinterpret_cast<std::uintptr_t>(m_map.base);
+        return addr-base<m_map.len;
+      }
+    }
+
+    // the inline buffer is never deallocated
+    bool inlined(const Tp* block) const noexcept {
+      if constexpr( Traits::inline_size==0 )
+        return false;
+      else
+        return block==m_inline.data();
+    }
+
+    void unmap(void) noexcept {
+      if constexpr( Traits::file_map ) {
+#ifdef RSFR_RMV_MMAP
+        if( m_map.base!=nullptr )
+          ::munmap(m_map.base, m_map.len);
+#endif
+        m_map = {};
+      }
+    }
+
+    // the elements must be destroyed before
+    void dlloc(Tp* block) noexcept {
+      if( mapped(block) || inlined(block) )
+        return;
+      m_stats.add(&mvstats::leaf_frees, block!=nullptr);
+      if constexpr( Traits::cow )
+        sval::dlloc(m_alloc, block);
+      else if constexpr( Traits::pool_slab==0 )
+        blk::val::dlloc(m_alloc, block);
+      else if( block!=nullptr )
+        m_vpool.deallocate(m_alloc, block);
+    }
+
+    void dlloc(Tp** block) noexcept {
+      if( mapped(block) )
+        return;
+      m_stats.add(&mvstats::index_frees, block!=nullptr);
+      if constexpr( Traits::cow )
+        sindex::dlloc(m_alloc, block);
+      else if constexpr( Traits::pool_slab==0 )
+        blk::index::dlloc(m_alloc, block);
+      else if( block!=nullptr )
+        m_ipool.deallocate(m_alloc, block);
+    }
+
     /**
      * @brief   Fill tree.
      * 
@@ -142,206 +903,69 @@ class mv {
      * @param   n      Num of blocks
      */
     void recursive_fill_blocks(mvp root,
-      mvlsize_type lvl, mvbsize_type& n) {
+      mvlsize_type lvl, size_type& n) {
       if( lvl==1 ) {
         // alloc block of value
-        for(auto i=mvb<Exp, Tp>::jump(lvl, m_peek+mvb<Exp, Tp>::size());
-            n!=0 && i<mvb<Exp, Tp>::size();
-            ++i, --n, m_peek+=mvb<Exp, Tp>::size())
-          root.index[i] = mvb<Exp, Tp>::val::alloc();
+        for(auto i=blk::jump(lvl, m_peek+blk::size());
+            n!=0 && i<blk::isize();
+            ++i, --n, m_peek+=blk::size())
+          m_tail = root.index[i] = alloc_val();
         return;
       }
       // alloc block of index
-      for(auto i=mvb<Exp, Tp>::jump(lvl, m_peek+mvb<Exp, Tp>::size());
-          n!=0 && i<mvb<Exp, Tp>::size(); ++i) {
+      for(auto i=blk::jump(lvl, m_peek+blk::size());
+          n!=0 && i<blk::isize(); ++i) {
         if( root.pindex[i]==nullptr )
-          root.pindex[i] = mvb<Exp, Tp>::index::alloc();
+          root.pindex[i] = alloc_index();
         recursive_fill_blocks({.index=root.pindex[i]}, lvl-1, n);
       }
     }
 
     /**
-     * @brief   Fill tree.
+     * @brief   Build subtree.
      * 
-     * Just fills the tree with blocks with initialization value,
-     * without increasing the height.
+     * Allocates the subtree for the next n blocks of value, left
+     * to right, each block of index is wired while its children
+     * are allocated. If it throws, the subtree is deallocated.
      * 
-     * @param   root   Root union
-     * @param   lvl    Level of tree
-     * @param   n      Num of blocks
-     * @param   val    Initialization value
+     * @param   lvl   Level of subtree
+     * @param   n     Num of blocks
      */
-    void recursive_fill_blocks(mvp root,
-      mvlsize_type lvl, mvbsize_type& n, const Tp& val) {
-      if( lvl==1 ) {
-        // alloc block of value
-        for(auto i=mvb<Exp, Tp>::jump(lvl, m_peek+mvb<Exp, Tp>::size());
-            n!=0 && i<mvb<Exp, Tp>::size();
-            ++i, --n, m_peek+=mvb<Exp, Tp>::size())
-          root.index[i] = mvb<Exp, Tp>::val::alloc(val);
-        return;
-      }
-      // alloc block of index
-      for(auto i=mvb<Exp, Tp>::jump(lvl, m_peek+mvb<Exp, Tp>::size());
-          n!=0 && i<mvb<Exp, Tp>::size(); ++i) {
-        if( root.pindex[i]==nullptr )
-          root.pindex[i] = mvb<Exp, Tp>::index::alloc();
-        recursive_fill_blocks({.index=root.pindex[i]}, lvl-1, n, val);
+    mvp recursive_build(mvlsize_type lvl, size_type& n) {
+      if( lvl==0 ) {
+        mvp root = {.val=alloc_val()};
+        --n;
+        return root;
       }
-    }
-
-////////////////////////////////////////////////////////////////////////////////
-
-    template <class Blk>
-    void recursive_backward(
-      mvp root,
-      Blk& head,
-      Blk& prev,
-      mvbsize_type n,
-      mvlsize_type lvl,
-      difference_type p,
-      difference_type& q) {
-      // traverse the blocks target
-      if( lvl==1 ) {
-        mvbdiff_type i=mvb<Exp, Tp>::jump(lvl, q);
-        for(; p<=q && i>=0; --i, q-=mvb<Exp, Tp>::size()) {
-          auto rem = mvb<Exp, Tp>::size()-n;
-          auto block = reinterpret_cast<Blk>(root.pindex[i]);
-          if( prev==nullptr ) {
-            prev = block;
-            std::move_backward(block, block+rem, block+mvb<Exp, Tp>::size());
-            continue;
-          }
-          std::move(block+rem, block+mvb<Exp, Tp>::size(), prev);
-          std::move_backward(block, block+rem, block+mvb<Exp, Tp>::size());
-          prev = block;
-        }
-        head = reinterpret_cast<Blk>(root.pindex[i]);
-        return;
-      }
-      // traverse block of index
-      for(mvbdiff_type i=mvb<Exp, Tp>::jump(lvl, q); p<=q && i>=0; --i)
-        recursive_backward<Blk>({.index=root.pindex[i]},
-          head, prev, n, lvl-1, p, q);
-    }
-
-    // template <class Blk>
-    // void rshift(mvlsize_type lvl, size_type i, mvbsize_type n) {
-    //   Blk head, prev = nullptr;
-    //   difference_type peek = m_peek>>(m_deep-lvl)*Exp;
-    //   auto iblock = i&mvb<Exp, Tp>::mask();
-    //   // shift the blocks with the same size
-    //   if( iblock==0 ) {
-    //     recursive_backward<Blk>(m_root, head, prev, n, lvl, i, peek);
-    //     std::fill_n(prev, n, std::remove_pointer_t<Blk>());
-    //     return;
-    //   }
-    //   recursive_backward<Blk>(m_root, head,
-    //     prev, n, lvl, i-iblock+mvb<Exp, Tp>::size(), peek);
-    //   if( iblock+n<=mvb<Exp, Tp>::size() ) {
-    //     auto rem = mvb<Exp, Tp>::size()-n;
-    //     if( prev!=nullptr )
-    //       std::move(head+rem, head+mvb<Exp, Tp>::size(), prev);
-    //     std::move_backward(head+iblock, head+rem, head+mvb<Exp, Tp>::size());
-    //     std::fill_n(head+iblock, n, std::remove_pointer_t<Blk>());
-    //   } else {
-    //     auto rem = mvb<Exp, Tp>::size()-iblock;
-    //     std::move(head+iblock, head+mvb<Exp, Tp>::size(), prev+(n-rem));
-    //     std::fill_n(head+iblock, rem, std::remove_pointer_t<Blk>());
-    //     std::fill_n(prev, n-rem, std::remove_pointer_t<Blk>());
-    //   }
-    // }
-
-    // template <class Blk>
-    // void rshift(mvlsize_type lvl,
-    //   size_type i, Blk block, mvbsize_type n) {
-    //   Blk head, prev = nullptr;
-    //   difference_type peek = m_peek>>(m_deep-lvl)*Exp;
-    //   auto iblock = i&mvb<Exp, Tp>::mask();
-    //   // shift the blocks with the same size
-    //   if( iblock==0 ) {
-    //     recursive_backward<Blk>(m_root, head, prev, n, lvl, i, peek);
-    //     std::fill_n(prev, n, std::remove_pointer_t<Blk>());
-    //     return;
-    //   }
-    //   recursive_backward<Blk>(m_root, head,
-    //     prev, n, lvl, i-iblock+mvb<Exp, Tp>::size(), peek);
-    //   if( iblock+n<=mvb<Exp, Tp>::size() ) {
-    //     auto rem = mvb<Exp, Tp>::size()-n;
-    //     if( prev!=nullptr )
-    //       std::move(head+rem, head+mvb<Exp, Tp>::size(), prev);
-    //     std::move_backward(head+iblock, head+rem, head+mvb<Exp, Tp>::size());
-    //     std::fill_n(head+iblock, n, std::remove_pointer_t<Blk>());
-    //   } else {
-    //     auto rem = mvb<Exp, Tp>::size()-iblock;
-    //     std::move(head+iblock, head+mvb<Exp, Tp>::size(), prev+(n-rem));
-    //     std::fill_n(head+iblock, rem, std::remove_pointer_t<Blk>());
-    //     std::fill_n(prev, n-rem, std::remove_pointer_t<Blk>());
-    //   }
-    // }
-
-    template <class Blk>
-    void lvl_rshift(mvlsize_type lvl, size_type i, mvbsize_type n,
-      std::function<void (std::remove_pointer_t<Blk>&)> create) {
-      Blk head, prev = nullptr;
-      difference_type peek = m_peek>>(m_deep-lvl)*Exp;
-      auto iblock = i&mvb<Exp, Tp>::mask();
-      // shift the blocks with the same size
-      if( iblock==0 ) {
-        recursive_backward<Blk>(m_root, head, prev, n, lvl, i, peek);
-        std::for_each_n(prev, n, create);
-        return;
-      }
-      recursive_backward<Blk>(m_root, head,
-        prev, n, lvl, i-iblock+mvb<Exp, Tp>::size(), peek);
-      if( iblock+n<=mvb<Exp, Tp>::size() ) {
-        auto rem = mvb<Exp, Tp>::size()-n;
-        if( prev!=nullptr )
-          std::move(head+rem, head+mvb<Exp, Tp>::size(), prev);
-        std::move_backward(head+iblock, head+rem, head+mvb<Exp, Tp>::size());
-        std::for_each_n(head+iblock, n, create);
-      } else {
-        auto rem = mvb<Exp, Tp>::size()-iblock;
-        std::move(head+iblock, head+mvb<Exp, Tp>::size(), prev+(n-rem));
-        std::for_each_n(head+iblock, rem, create);
-        std::for_each_n(prev, n-rem, create);
+      mvp root = {.index=alloc_index()};
+      mvbsize_type i = 0;
+      try {
+        for(; n!=0 && i<blk::isize(); ++i)
+          root.pindex[i] = recursive_build(lvl-1, n).index;
+      } catch(...) {
+        while( i!=0 )
+          recursive_dlloc({.index=root.pindex[--i]}, lvl-1);
+        dlloc(root.index);
+        throw;
       }
+      return root;
     }
 
-    static void recursive_build(mvp root, mvlsize_type lvl, size_type& peek) {
-      if( lvl==1 ) {
-        // alloc block of value
-        for(auto i=mvb<Exp, Tp>::jump(lvl, peek+mvb<Exp, Tp>::size());
-            i<mvb<Exp, Tp>::size(); ++i, peek+=mvb<Exp, Tp>::size())
-          root.index[i] = mvb<Exp, Tp>::val::alloc();
+    // dealloc a subtree without elements
+    void recursive_dlloc(mvp root, mvlsize_type lvl) noexcept {
+      if( lvl==0 ) {
+        dlloc(root.val);
         return;
       }
-      // alloc block of index
-      for(auto i=mvb<Exp, Tp>::jump(lvl, peek+mvb<Exp, Tp>::size());
-          i<mvb<Exp, Tp>::size(); ++i) {
-        if( root.pindex[i]==nullptr )
-          root.pindex[i] = mvb<Exp, Tp>::index::alloc();
-        recursive_build({.index=root.pindex[i]}, lvl-1, peek);
-      }
-    }
-    
-    static mvp build(mvlsize_type deep) {
-      mvlsize_type lvl = 0;
-      size_type peek = mvb<Exp, Tp>::mask();
-      mvp root = {.val=mvb<Exp, Tp>::val::alloc()};
-      while( deep!=0 ) {
-        if( peek==end_peek(lvl) ) {
-          auto block = root;
-          root.index = mvb<Exp, Tp>::index::alloc();
-          root.pindex[0] = block.index;
-          --deep;
-          ++lvl;
-        }
-        recursive_build(root, lvl, peek);
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        if( root.pindex[i]!=nullptr )
+          recursive_dlloc({.index=root.pindex[i]}, lvl-1);
       }
-      return root;
+      dlloc(root.index);
     }
 
+////////////////////////////////////////////////////////////////////////////////
+
   public:
     template <class Blk>
     void print_block(Blk block, mvbsize_type n) {
@@ -352,32 +976,7 @@ class mv {
       std::cout<<std::endl;
     }
     
-    void rmv_testing(void) {
-      // build(2);
-      // print_tree(build(3), 0, 3);
-      // rshift<Tp*>(2, 3, 3, [](Tp& elm) {
-      //   elm = 1000;
-      // });
-      // rshift<Tp**>(1, 0, 2, [](auto& elm) {
-      //   elm = build(0).val;
-      // });
-
-      // rshift(0, 4);
-    }
-
-    void rshift(size_type i, size_type n) {
-      fill(n);
-      auto block = m_root;
-      for(mvlsize_type lvl=1; lvl<m_deep; ++lvl) {
-        auto h = m_deep-lvl;
-
-        std::cout<<( end_size(m_deep-lvl) )<<":"<<h<<std::endl;
-        // if( lvl==m_deep )
-        //   lvl_rshift<Tp*>(lvl, 0, 2, [](auto& elm) {
-        //     elm = 10;
-        //   });
-      }
-    }
+    void rmv_testing(void) {}
 ////////////////////////////////////////////////////////////////////////////////
 
   private:
@@ -394,23 +993,24 @@ class mv {
      *            reduced.
      */
     bool recursive_reduce_blocks(mvp root,
-      mvlsize_type lvl, mvbsize_type& n)
+      mvlsize_type lvl, size_type& n)
       noexcept(std::is_nothrow_destructible_v<Tp>) {
       if( lvl==1 ) {
-        mvbdiff_type i=mvb<Exp, Tp>::jump(lvl, m_peek);
+        mvbdiff_type i=blk::jump(lvl, m_peek);
         // dealloc block of value
-        for(; n!=0 && i>=0; --i, --n, m_peek-=mvb<Exp, Tp>::size()) {
-          mvb<Exp, Tp>::dlloc(root.index[i]);
+        for(; n!=0 && i>=0; --i, --n, m_peek-=blk::size()) {
+          m_cache.erase(m_peek>>Exp);
+          dlloc(root.index[i]);
           root.index[i] = nullptr;
         }
         return i<0;
       }
-      mvbdiff_type i=mvb<Exp, Tp>::jump(lvl, m_peek);
+      mvbdiff_type i=blk::jump(lvl, m_peek);
       // dealloc block of index
       for(; i>=0; --i) {
         if( !recursive_reduce_blocks({.index=root.pindex[i]}, lvl-1, n) )
           return false;
-        mvb<Exp, Tp>::dlloc(root.pindex[i]);
+        dlloc(root.pindex[i]);
         root.pindex[i] = nullptr;
       }
       return i<0;
@@ -427,34 +1027,123 @@ class mv {
     void recursive_destroy(mvp root, mvlsize_type lvl)
       noexcept(std::is_nothrow_destructible_v<Tp>) {
       if( lvl==1 ) {
-        // dealloc block of value
-        for(mvbdiff_type i=mvb<Exp, Tp>::jump(lvl, m_peek);
-            i>=0; --i, m_peek-=mvb<Exp, Tp>::size())
-          mvb<Exp, Tp>::dlloc(root.index[i]);
+        // destroy the elements and dealloc block of value,
+        // only the first block visited is the partial one
+        for(mvbdiff_type i=blk::jump(lvl, m_peek);
+            i>=0; --i, m_peek-=blk::size()) {
+          destroy_n(root.index[i], blk::size()-m_free);
+          dlloc(root.index[i]);
+          m_free = 0;
+        }
         return;
       }
       // dealloc block of index
-      for(mvbdiff_type i=mvb<Exp, Tp>::jump(lvl, m_peek); i>=0; --i) {
+      for(mvbdiff_type i=blk::jump(lvl, m_peek); i>=0; --i) {
         recursive_destroy({.index=root.pindex[i]}, lvl-1);
-        mvb<Exp, Tp>::dlloc(root.pindex[i]);
+        dlloc(root.pindex[i]);
+      }
+    }
+
+    /**
+     * Reference counting of blocks of copy-on-write vector, lvl
+     * is the level of block, zero for block of value.
+     */
+    static typename blk::refs_type&
+      refs(mvp block, mvlsize_type lvl) noexcept {
+      return lvl==0 ? sval::refs(block.val) :
+        sindex::refs(block.index);
+    }
+    static void share(mvp block, mvlsize_type lvl) noexcept
+      { refs(block, lvl).fetch_add(1, std::memory_order_relaxed); }
+    static bool shared(mvp block, mvlsize_type lvl) noexcept
+      { return refs(block, lvl).load(std::memory_order_acquire)!=1; }
+    // drop a reference, true if it was the last one
+    static bool unref(mvp block, mvlsize_type lvl) noexcept {
+      return refs(block, lvl).fetch_sub(1,
+        std::memory_order_acq_rel)==1;
+    }
+
+    // num of elements in the block of value at base
+    size_type live(size_type base) const noexcept {
+      return base>=size() ? 0 :
+        std::min<size_type>(size()-base, blk::size());
+    }
+
+    /**
+     * @brief   Release subtree.
+     * 
+     * Drops a reference of the subtree, a block is destroyed with
+     * its last reference.
+     * 
+     * @param   root   Root union
+     * @param   lvl    Level of root
+     * @param   base   Position of the first element of root
+     */
+    void release_tree(mvp root, mvlsize_type lvl, size_type base)
+      noexcept(std::is_nothrow_destructible_v<Tp>) {
+      if( !unref(root, lvl) )
+        return;
+      if( lvl==0 ) {
+        destroy_n(root.val, live(base));
+        dlloc(root.val);
+        return;
+      }
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        if( root.pindex[i]!=nullptr )
+          release_tree({.index=root.pindex[i]}, lvl-1,
+            base+(static_cast<size_type>(i)<<blk::shift(lvl)));
+      }
+      dlloc(root.index);
+    }
+
+    /**
+     * @brief   Clone shared block.
+     * 
+     * The clone takes over the reference of this vector, the
+     * children of a block of index gain a reference.
+     * 
+     * @param   block   Shared block
+     * @param   lvl     Level of block
+     * @param   base    Position of the first element of block
+     */
+    mvp clone(mvp block, mvlsize_type lvl, size_type base) {
+      mvp copy;
+      if( lvl==0 ) {
+        copy.val = alloc_val();
+        try {
+          uninit_copy(block.val, live(base), copy.val);
+        } catch(...) {
+          dlloc(copy.val);
+          throw;
+        }
+      } else {
+        copy.index = alloc_index();
+        std::copy_n(block.pindex, blk::isize(), copy.pindex);
+        for(mvbsize_type i=0; i<blk::isize(); ++i) {
+          if( copy.pindex[i]!=nullptr )
+            share({.index=copy.pindex[i]}, lvl-1);
+        }
       }
+      // the other owners may be gone meanwhile
+      release_tree(block, lvl, base);
+      return copy;
     }
 
   protected:
     static constexpr size_type
       end_size(mvlsize_type deep) noexcept
-      { return static_cast<size_type>(1)<<Exp*(deep+1); }
+      { return static_cast<size_type>(1)<<blk::shift(deep+1); }
     static constexpr size_type
       end_peek(mvlsize_type deep) noexcept
       { return end_size(deep)-1; }
 
-    void fill_blocks(mvbsize_type n) {
+    void fill_blocks(size_type n) {
       if( n==0 )
         return;
       // if the tree is empty, alloc block of value as root
       if( m_peek==0 ) {
-        m_root.val = mvb<Exp, Tp>::val::alloc();
-        m_peek = mvb<Exp, Tp>::mask();
+        m_tail = m_root.val = alloc_val();
+        m_peek = blk::mask();
         --n;
       }
       while( n!=0 ) {
@@ -462,62 +1151,68 @@ class mv {
         // increase the tree height with alloc block of index
         if( m_peek==end_peek(m_deep) ) {
           auto block = m_root;
-          m_root.index = mvb<Exp, Tp>::index::alloc();
+          m_root.index = alloc_index();
           m_root.pindex[0] = block.index;
           ++m_deep;
+          m_stats.add(&mvstats::grows);
         }
         // fill the tree with blocks
         recursive_fill_blocks(m_root, m_deep, n);
       }
     }
 
-    void fill_blocks(mvbsize_type n, const Tp& val) {
-      if( n==0 )
-        return;
-      // if the tree is empty, alloc block of value as root
-      if( m_peek==0 ) {
-        m_root.val = mvb<Exp, Tp>::val::alloc(val);
-        m_peek = mvb<Exp, Tp>::mask();
-        --n;
-      }
-      while( n!=0 ) {
-        // if the tree is not fit,
-        // increase the tree height with alloc block of index
-        if( m_peek==end_peek(m_deep) ) {
-          auto block = m_root;
-          m_root.index = mvb<Exp, Tp>::index::alloc();
-          m_root.pindex[0] = block.index;
-          ++m_deep;
-        }
-        // fill the tree with blocks
-        recursive_fill_blocks(m_root, m_deep, n, val);
-      }
-    }
-
-    void reduce_blocks(mvbsize_type n)
-      noexcept(std::is_nothrow_destructible_v<Tp>) {
-      if( n==0 || m_peek==0 )
+    /**
+     * @brief   Build tree.
+     * 
+     * Same as fill_blocks() for an empty vector, but the height
+     * is known up front, so the tree is built in one pass without
+     * raising the root level by level.
+     * 
+     * @param   n   Num of blocks, greater than zero
+     */
+    void build_blocks(size_type n) {
+      mvlsize_type deep = 0;
+      while( ((n-1)>>(blk::shift(deep+1)-Exp))!=0 )
+        ++deep;
+      auto rem = n;
+      m_root = recursive_build(deep, rem);
+      m_deep = deep;
+      m_peek = (n<<Exp)-1;
+      m_tail = rand_block(m_peek);
+      m_stats.add(&mvstats::grows, deep);
+    }
+
+    void reduce_blocks(size_type n)
+      noexcept(std::is_nothrow_destructible_v<Tp>) {
+      if( n==0 || m_peek==0 )
         return;
       // if only block of value, dealloc block of value
       if( m_deep==0 ) {
-        mvb<Exp, Tp>::dlloc(m_root.val);
-        m_root.val = nullptr;
+        m_cache.erase(0);
+        dlloc_root(m_root.val, std::exchange(m_tier, 0));
+        m_root.val = m_tail = nullptr;
         m_peek = 0;
+        unmap();
         return;
       }
       // if the tree need to be destroyed, dealloc block of index
       if( recursive_reduce_blocks(m_root, m_deep, n) ) {
-        mvb<Exp, Tp>::dlloc(m_root.index);
+        dlloc(m_root.index);
         m_root.index = nullptr;
+        m_tail = nullptr;
+        m_stats.add(&mvstats::shrinks, m_deep);
         m_peek = m_deep = 0;
+        unmap();
         return;
       }
+      m_tail = rand_block(m_peek);
       // if the tree doesn't need to be destroyed,
       // reduce the height with dealloc block of index
       while( m_peek<=end_peek(m_deep-1) ) {
         auto block = m_root;
         m_root.index = m_root.pindex[0];
-        mvb<Exp, Tp>::dlloc(block.index);
+        dlloc(block.index);
+        m_stats.add(&mvstats::shrinks);
         if( --m_deep==0 )
           return;
       }
@@ -526,88 +1221,842 @@ class mv {
     Tp* push_block(void) {
       // if the tree is empty, alloc block of value as root
       if( m_peek==0 ) {
-        m_root.val = mvb<Exp, Tp>::val::alloc();
-        m_peek = mvb<Exp, Tp>::mask();
-        return m_root.val;
+        mvlsize_type tier;
+        m_tail = m_root.val = alloc_root(1, tier);
+        m_tier = tier;
+        m_peek = blk::mask();
+        return m_tail;
       }
+      // the path of tail is written
+      own_tail();
       auto block = m_root;
       // if the tree is not enough,
       // increase the height with alloc block of index
       if( m_peek==end_peek(m_deep) ) {
-        m_root.index = mvb<Exp, Tp>::index::alloc();
+        m_root.index = alloc_index();
         m_root.pindex[0] = block.index;
         block = m_root;
         ++m_deep;
+        m_stats.add(&mvstats::grows);
       }
-      m_peek += mvb<Exp, Tp>::size();
+      m_peek += blk::size();
       // fill the block of index with alloc block of index
-      for(auto lvl=m_deep; lvl>1; --lvl) {
-        auto i = mvb<Exp, Tp>::jump(lvl, m_peek);
+      blk::template descend<1>(m_deep, [&](auto lvl) {
+        auto i = blk::jump(lvl, m_peek);
         if( block.pindex[i]==nullptr )
-          block.pindex[i] = mvb<Exp, Tp>::index::alloc();
+          block.pindex[i] = alloc_index();
         block.index = block.pindex[i];
-      }
+      });
       // alloc block of value
-      return block.index[mvb<Exp, Tp>::jump(1, m_peek)]=
-        mvb<Exp, Tp>::val::alloc();
+      return m_tail = block.index[blk::jump(1, m_peek)]=
+        alloc_val();
     }
 
-    Tp* head_block(void) noexcept {
+    Tp* head_block(void) const noexcept {
       auto block = m_root;
-      for(auto lvl=m_deep; lvl>0; --lvl)
-        block.index = block.pindex[0];
+      blk::descend(m_deep, [&block](auto) noexcept
+        { block.index = block.pindex[0]; });
       return block.val;
     }
 
-    Tp* rand_block(size_type i) noexcept {
+    Tp* rand_block(size_type i) const noexcept {
+      m_stats.add(&mvstats::descents);
       auto block = m_root;
-      for(auto lvl=m_deep; lvl>0; --lvl)
-        block.index = block.pindex[mvb<Exp, Tp>::jump(lvl, i)];
+      blk::descend(m_deep, [&block, i](auto lvl) noexcept
+        { block.index = block.pindex[blk::jump(lvl, i)]; });
       return block.val;
     }
 
-    Tp* tail_block(void) noexcept { return access_block(m_peek); }
+    // num of positions resolved together by batch_blocks()
+    static constexpr size_type batch = 32;
+
+    /**
+     * @brief   Blocks of value of a batch of positions.
+     * 
+     * A run of positions in the same block of value shares one
+     * descent. The paths are walked level by level, so the loads
+     * of a level do not depend on each other and their misses
+     * overlap, while the slots of the next level are prefetched.
+     * 
+     * @param   idx      Positions, each below the size
+     * @param   n        Num of positions, at most batch
+     * @param   blocks   Receives the block of value of each position
+     */
+    void batch_blocks(const size_type* idx, size_type n,
+      Tp** blocks) const noexcept {
+      mvbsize_type of[batch], m = 0;
+      size_type pos[batch];
+      mvp path[batch];
+      for(mvbsize_type k=0; k<n; ++k) {
+        if( m==0 || (pos[m-1]>>Exp)!=(idx[k]>>Exp) ) {
+          pos[m] = idx[k];
+          path[m++] = m_root;
+        }
+        of[k] = m-1;
+      }
+      m_stats.add(&mvstats::descents, m);
+      blk::descend(m_deep, [&](auto lvl) noexcept {
+        for(mvbsize_type j=0; j<m; ++j) {
+          path[j].index = path[j].pindex[blk::jump(lvl, pos[j])];
+          if( lvl>1 )
+            RSFR_RMV_PREFETCH(path[j].pindex+
+              blk::jump(lvl-1, pos[j]));
+          else
+            RSFR_RMV_PREFETCH(path[j].val+blk::jump(0, pos[j]));
+        }
+      });
+      for(mvbsize_type k=0; k<n; ++k)
+        blocks[k] = path[of[k]].val;
+    }
+
+    /**
+     * @brief   Cached block of value.
+     * 
+     * Same as rand_block(), but looks up the block cache first.
+     * Blocks never move while they are allocated, so only the
+     * deallocation of blocks invalidates the cache.
+     * 
+     * @param   i   Position of element
+     */
+    Tp* cache_block(size_type i) const noexcept {
+      if constexpr( Traits::cache_sets==0 )
+        return rand_block(i);
+      else {
+        auto block = m_cache.find(i>>Exp);
+        m_stats.add(block!=nullptr ? &mvstats::cache_hits :
+          &mvstats::cache_misses);
+        if( block==nullptr )
+          m_cache.insert(i>>Exp, block=rand_block(i));
+        return block;
+      }
+    }
+
+    /**
+     * @brief   Find block of value.
+     * 
+     * Same as rand_block(), but safe for positions outside the
+     * allocated blocks.
+     * 
+     * @param   i   Position of element
+     * 
+     * @return  Block of value which holds position i, or nullptr
+     *          if the block is not allocated.
+     */
+    Tp* find_block(difference_type i) const noexcept {
+      if( m_peek==0 || i<0 || static_cast<size_type>(i)>m_peek )
+        return nullptr;
+      return rand_block(static_cast<size_type>(i));
+    }
+
+    Tp* tail_block(void) const noexcept { return m_tail; }
+
+    /**
+     * @brief   Writable block of value.
+     * 
+     * Same as rand_block(), but a copy-on-write vector clones the
+     * shared blocks on the path first, so the block belongs to
+     * this vector only.
+     * 
+     * @param   i   Position of element
+     */
+    Tp* write_block(size_type i) {
+      if constexpr( !Traits::cow )
+        return rand_block(i);
+      else {
+        m_stats.add(&mvstats::descents);
+        bool fresh = false;
+        if( shared(m_root, m_deep) ) {
+          m_root = clone(m_root, m_deep, 0);
+          fresh = m_deep==0;
+        }
+        auto block = m_root;
+        for(auto lvl=m_deep; lvl>0; --lvl) {
+          auto& child = block.pindex[blk::jump(lvl, i)];
+          if( shared({.index=child}, lvl-1) ) {
+            child = clone({.index=child}, lvl-1,
+              i>>blk::shift(lvl)<<blk::shift(lvl)).index;
+            fresh = lvl==1;
+          }
+          block.index = child;
+        }
+        if( fresh ) {
+          m_cache.erase(i>>Exp);
+          if( (i>>Exp)==(m_peek>>Exp) )
+            m_tail = block.val;
+        }
+        return block.val;
+      }
+    }
+
+    // writable blocks of value for [first, last)
+    void unshare(size_type first, size_type last) {
+      if constexpr( Traits::cow ) {
+        first &= ~static_cast<size_type>(blk::mask());
+        for(; first<last; first+=blk::size())
+          write_block(first);
+      }
+    }
+
+    // writable tail block, the vector must not be empty
+    Tp* own_tail(void) {
+      if constexpr( Traits::cow )
+        return write_block(m_peek);
+      else
+        return m_tail;
+    }
+
+    // largest num of elements a small root block of value holds
+    static constexpr size_type small_size =
+      Traits::tier_exponent!=0 ? blk::size()/2 : Traits::inline_size;
+
+    // root block of value smaller than a block, see leave_root()
+    struct mvsmall {
+      Tp* block;
+      mvlsize_type tier;
+    };
+
+    // size of the root block of value of a single block tree
+    size_type root_size(void) const noexcept {
+      if( inlined(m_root.val) )
+        return Traits::inline_size;
+      return m_tier!=0 ? static_cast<size_type>(1)<<m_tier :
+        blk::size();
+    }
+
+    /**
+     * @brief   Alloc root block of value.
+     * 
+     * Takes the inline buffer, the smallest tier or a whole block,
+     * whichever first holds n elements.
+     * 
+     * @param   n      Num of elements
+     * @param   tier   Receives the exponent of a tier, or zero
+     */
+    Tp* alloc_root(size_type n, mvlsize_type& tier) {
+      tier = 0;
+      if( n<=Traits::inline_size )
+        return m_inline.data();
+      if constexpr( Traits::tier_exponent!=0 ) {
+        if( n<=small_size ) {
+          mvlsize_type exp = Traits::tier_exponent;
+          while( (static_cast<size_type>(1)<<exp)<n )
+            ++exp;
+          auto block = val_traits::allocate(m_alloc,
+            static_cast<size_type>(1)<<exp);
+          m_stats.add(&mvstats::leaf_allocs);
+          tier = exp;
+          return block;
+        }
+      }
+      return alloc_val();
+    }
+
+    // a tier goes back to the allocator, not to the block pool
+    void dlloc_root(Tp* block, mvlsize_type tier) noexcept {
+      if( tier==0 ) {
+        dlloc(block);
+        return;
+      }
+      m_stats.add(&mvstats::leaf_frees);
+      val_traits::deallocate(m_alloc, block,
+        static_cast<size_type>(1)<<tier);
+    }
+
+    /**
+     * @brief   Leave a small root block of value.
+     * 
+     * The inline buffer and the tiers count as a whole block of
+     * value. Before the size passes the root block, a larger one
+     * replaces it, twice the size for the tiers. The new elements
+     * are constructed there first, then spill_root() moves the old
+     * ones over, so the arguments may still refer to them.
+     * 
+     * @param   n   Num of elements added
+     * 
+     * @return  The replaced root block, or a null block.
+     */
+    mvsmall leave_root(size_type n) {
+      if constexpr( small_size!=0 ) {
+        if( m_peek!=0 && m_deep==0 && root_size()<blk::size() &&
+            size()+n>root_size() ) {
+          mvlsize_type tier;
+          auto block = alloc_root(std::min<size_type>(std::max(
+            size()+n, root_size()<<1), blk::size()), tier);
+          m_cache.erase(0);
+          m_tail = block;
+          return {std::exchange(m_root.val, block),
+            std::exchange(m_tier, tier)};
+        }
+      }
+      return {};
+    }
+
+    // move n elements of the old root block to the first block
+    void spill_root(mvsmall old, size_type n) noexcept {
+      uninit_move(old.block, n, head_block());
+      destroy_n(old.block, n);
+      dlloc_root(old.block, old.tier);
+    }
+
+    // undo leave_root(), the tree is down to its root block
+    void enter_root(mvsmall old) noexcept {
+      dlloc_root(m_root.val, std::exchange(m_tier, old.tier));
+      m_root.val = m_tail = old.block;
+    }
+
+    // share the tree of other, this vector must be empty
+    void share_tree(const mv& other) noexcept {
+      if( other.m_peek==0 )
+        return;
+      share(other.m_root, other.m_deep);
+      m_root = other.m_root;
+      m_peek = other.m_peek;
+      m_deep = other.m_deep;
+      m_free = other.m_free;
+      m_tail = other.m_tail;
+    }
     void pop_block(void) noexcept(std::is_nothrow_destructible_v<Tp>)
       { return reduce_blocks(1); }
 
-  public:
-    void fill(size_type n) {
-      auto new_size = size()+n;
-      if( m_free>n ) {
-        m_free -= n;
+    size_type num_blocks(void) const noexcept
+      { return m_peek==0 ? 0 : (m_peek>>Exp)+1; }
+
+    /**
+     * @brief   Grow the size.
+     * 
+     * Allocates the blocks for n more elements, then constructs
+     * them block by block. If it throws, the vector is left as it
+     * was before.
+     * 
+     * @param   n        Num of elements
+     * @param   create   Constructs count elements at first,
+     *                   create(first, count)
+     */
+    template <class Create>
+    void grow(size_type n, Create create) {
+      auto old_size = size();
+      auto old_free = m_free;
+      auto old_blocks = num_blocks();
+      auto pos = old_size;
+      // the path of tail is written
+      if( m_peek!=0 )
+        own_tail();
+      auto old = leave_root(n);
+      try {
+        if( m_free<n ) {
+          auto rem = n-m_free;
+          auto blocks = (rem>>Exp)+((rem&blk::mask())!=0);
+          if( m_peek==0 && n<=small_size ) {
+            mvlsize_type tier;
+            m_tail = m_root.val = alloc_root(n, tier);
+            m_tier = tier;
+            m_peek = blk::mask();
+            m_free = blk::size();
+          } else if( m_peek==0 )
+            build_blocks(blocks);
+          else
+            fill_blocks(blocks);
+        }
+        // a nothrow construction of many elements runs in parallel
+        if constexpr( std::is_nothrow_invocable_v<Create&,
+            Tp*, size_type> ) {
+          if( n>=par_grow ) {
+            grow_par(pos, old_size+n, create);
+            pos = old_size+n;
+          }
+        }
+        for(size_type len; pos<old_size+n; pos+=len) {
+          auto off = blk::jump(0, pos);
+          len = std::min<size_type>(blk::size()-off,
+            old_size+n-pos);
+          create(rand_block(pos)+off, len);
+        }
+      } catch(...) {
+        destroy_elms(old_size, pos);
+        reduce_blocks(num_blocks()-old_blocks);
+        if( old.block!=nullptr )
+          enter_root(old);
+        m_free = old_free;
+        throw;
+      }
+      if( old.block!=nullptr )
+        spill_root(old, old_size);
+      m_free = capacity()-(old_size+n);
+    }
+
+    // num of elements from which grow() constructs in parallel
+    static constexpr size_type par_grow = size_type{1}<<16;
+
+    template <class Create>
+    void grow_par(size_type first, size_type last, Create& create)
+      noexcept {
+      auto b0 = first>>Exp;
+      auto b1 = ((last-1)>>Exp)+1;
+      RSFR_RMV_OMP(omp parallel for schedule(static))
+      for(size_type b=b0; b<b1; ++b) {
+        auto lo = std::max(first, b<<Exp);
+        auto hi = std::min(last, (b+1)<<Exp);
+        create(rand_block(lo)+blk::jump(0, lo), hi-lo);
+      }
+    }
+
+    /**
+     * @brief   Walk the segments.
+     * 
+     * @param   first   Begin position
+     * @param   last    End position
+     * @param   fn      Called for each contiguous run of elements
+     *                  inside one block of value, fn(elm, count)
+     */
+    template <class Fn>
+    void for_segments(size_type first, size_type last, Fn fn) const {
+      for(size_type len; first<last; first+=len) {
+        auto off = blk::jump(0, first);
+        len = std::min<size_type>(blk::size()-off, last-first);
+        fn(rand_block(first)+off, len);
+      }
+    }
+
+    void destroy_elms(size_type first, size_type last)
+      noexcept(std::is_nothrow_destructible_v<Tp>) {
+      if constexpr( !blk::plain || !std::is_trivially_destructible_v<Tp> )
+        for_segments(first, last, [this](Tp* elm, size_type count) {
+          destroy_n(elm, count);
+        });
+    }
+
+    /**
+     * Move the elements of [first, last) to d_first (forward) or
+     * to d_last (backward). The runs which are contiguous in both
+     * blocks of source and destination are moved at once.
+     */
+    void move_elms(size_type first, size_type last, size_type d_first) {
+      for(size_type len; first<last; first+=len, d_first+=len) {
+        auto src = blk::jump(0, first);
+        auto dst = blk::jump(0, d_first);
+        len = std::min<size_type>({blk::size()-src,
+          blk::size()-dst, last-first});
+        auto block = rand_block(first)+src;
+        std::move(block, block+len, rand_block(d_first)+dst);
+      }
+    }
+
+    void move_elms_backward(size_type first,
+      size_type last, size_type d_last) {
+      for(size_type len; first<last; last-=len, d_last-=len) {
+        size_type src = blk::jump(0, last-1)+1;
+        size_type dst = blk::jump(0, d_last-1)+1;
+        len = std::min<size_type>({src, dst, last-first});
+        auto block = rand_block(last-1)+src;
+        std::move_backward(block-len, block, rand_block(d_last-1)+dst);
+      }
+    }
+
+    /**
+     * @brief   Shift right.
+     * 
+     * Opens a gap of n elements at position i, the elements of
+     * [i, size) are moved to [i+n, size+n) block by block.
+     * 
+     * @param   i           Position of gap
+     * @param   n           Num of elements
+     * @param   construct   Constructs the elements of the gap
+     *                      which are beyond the old size,
+     *                      construct(elm, count)
+     * @param   assign      Assigns the moved-from elements of the
+     *                      gap, assign(elm, count)
+     */
+    template <class Construct, class Assign>
+    void rshift(size_type i, size_type n,
+      Construct construct, Assign assign) {
+      if( n==0 )
+        return;
+      unshare(i, size());
+      // the old elements are read by position while it grows
+      if( auto old = leave_root(n); old.block!=nullptr )
+        spill_root(old, size());
+      auto old_size = size();
+      auto pos = old_size;
+      // the new tail takes the gap beyond the old size, then
+      // the last elements moved out of the old size
+      grow(n, [&](Tp* elm, size_type count) {
+        auto gap = std::min<size_type>(i+n>pos ? i+n-pos : 0, count);
+        if( gap!=0 )
+          construct(elm, gap);
+        auto out = elm+gap;
+        try {
+          for_segments(pos+gap-n, pos+count-n,
+            [this, &out](Tp* src, size_type len) {
+              out = uninit_move(src, len, out);
+            });
+        } catch(...) {
+          destroy_n(elm, static_cast<size_type>(out-elm));
+          throw;
+        }
+        pos += count;
+      });
+      if( old_size>i+n )
+        move_elms_backward(i, old_size-n, old_size);
+      for_segments(i, std::min(i+n, old_size), assign);
+    }
+
+    /**
+     * @brief   Shift left.
+     * 
+     * Closes a gap of n elements at position i, the elements of
+     * [i+n, size) are moved to [i, size-n) block by block, then
+     * the last n elements are reduced.
+     * 
+     * @param   i   Position of gap
+     * @param   n   Num of elements
+     */
+    void lshift(size_type i, size_type n) {
+      if( n==0 )
         return;
+      unshare(i, size());
+      move_elms(i+n, size(), i);
+      reduce(n);
+    }
+
+    /**
+     * Elements are constructed and destroyed through the allocator.
+     * The bulk helpers are all-or-nothing and fall back to the
+     * plain algorithms when the allocator allows it.
+     */
+    template <class... Args>
+    Tp* construct(Tp* elm, Args&&... args) {
+      val_traits::construct(m_alloc, elm, std::forward<Args>(args)...);
+      return elm;
+    }
+
+    void destroy_n(Tp* elm, size_type n)
+      noexcept(std::is_nothrow_destructible_v<Tp>) {
+      if constexpr( blk::plain )
+        std::destroy_n(elm, n);
+      else
+        for(; n!=0; --n, ++elm)
+          val_traits::destroy(m_alloc, elm);
+    }
+
+    template <class Make>
+    void make_n(Tp* elm, size_type n, Make make) {
+      size_type i = 0;
+      try {
+        for(; i<n; ++i)
+          make(elm+i);
+      } catch(...) {
+        destroy_n(elm, i);
+        throw;
       }
-      n -= m_free;
-      mvbsize_type nblocks = (n>>Exp)+((n&mvb<Exp, Tp>::mask())!=0);
-      fill_blocks(nblocks);
-      m_free = capacity()-new_size;
+    }
+
+    void uninit_default(Tp* elm, size_type n) {
+      if constexpr( blk::plain )
+        std::uninitialized_default_construct_n(elm, n);
+      else
+        make_n(elm, n, [this](Tp* p) { construct(p); });
+    }
+
+    void uninit_fill(Tp* elm, size_type n, const Tp& val) {
+      if constexpr( blk::plain )
+        std::uninitialized_fill_n(elm, n, val);
+      else
+        make_n(elm, n, [this, &val](Tp* p) { construct(p, val); });
+    }
+
+    // return the iterator past the copied elements
+    template <std::input_iterator It>
+    It uninit_copy(It first, size_type n, Tp* elm) {
+      if constexpr( blk::plain && std::contiguous_iterator<It> &&
+          std::is_trivially_copyable_v<Tp> ) {
+        if( n!=0 )
+          std::memcpy(elm, std::to_address(first), n*sizeof(Tp));
+        return first+n;
+      } else if constexpr( blk::plain ) {
+        return std::ranges::uninitialized_copy_n(first,
+          n, elm, elm+n).in;
+      } else {
+        make_n(elm, n, [this, &first](Tp* p) {
+          construct(p, *first);
+          ++first;
+        });
+        return first;
+      }
+    }
+
+    // return the end of the moved elements
+    Tp* uninit_move(Tp* src, size_type n, Tp* elm) {
+      if constexpr( blk::plain )
+        return std::uninitialized_move_n(src, n, elm).second;
+      else {
+        make_n(elm, n, [this, &src](Tp* p) {
+          construct(p, std::move(*src++));
+        });
+        return elm+n;
+      }
+    }
+
+    /**
+     * @brief   Steal the blocks.
+     * 
+     * Takes the tree and the block pools of other, which is left
+     * empty. This vector must be empty and its allocator must be
+     * able to free the blocks of other.
+     */
+    void steal(mv& other) noexcept {
+      purge();
+      m_vpool.swap(other.m_vpool);
+      m_ipool.swap(other.m_ipool);
+      m_root = std::exchange(other.m_root, {});
+      m_peek = std::exchange(other.m_peek, 0);
+      m_deep = std::exchange(other.m_deep, 0);
+      m_tier = std::exchange(other.m_tier, 0);
+      m_free = std::exchange(other.m_free, 0);
+      m_tail = std::exchange(other.m_tail, nullptr);
+      m_map = std::exchange(other.m_map, {});
+      m_cache.clear();
+      other.m_cache.clear();
+      // the elements of the inline buffer of other move here
+      if( m_peek!=0 && other.inlined(m_root.val) ) {
+        uninit_move(m_root.val, size(), m_inline.data());
+        destroy_n(m_root.val, size());
+        m_root.val = m_tail = m_inline.data();
+      }
+    }
+
+    // return the slabs of the block pools, the vector must be
+    // empty
+    void purge(void) noexcept {
+      m_vpool.purge(m_alloc);
+      m_ipool.purge(m_alloc);
+    }
+
+    void swap_blocks(mv& other) noexcept {
+      // an inline buffer can't be swapped, it moves by steal
+      if constexpr( Traits::inline_size!=0 ) {
+        if( (m_peek!=0 && inlined(m_root.val)) ||
+            (other.m_peek!=0 && other.inlined(other.m_root.val)) ) {
+          mv tmp{m_alloc};
+          tmp.steal(other);
+          other.steal(*this);
+          steal(tmp);
+          return;
+        }
+      }
+      m_vpool.swap(other.m_vpool);
+      m_ipool.swap(other.m_ipool);
+      std::swap(m_root, other.m_root);
+      std::swap(m_peek, other.m_peek);
+      std::swap(m_deep, other.m_deep);
+      std::swap(m_tier, other.m_tier);
+      std::swap(m_free, other.m_free);
+      std::swap(m_tail, other.m_tail);
+      std::swap(m_map, other.m_map);
+      m_cache.clear();
+      other.m_cache.clear();
+    }
+
+    /**
+     * @brief   Map the file.
+     * 
+     * Maps a file of save() privately, then turns the offsets of
+     * blocks of index into pointers in place. Blocks of value are
+     * read straight from the page cache, a page is copied by the
+     * kernel only when it is written, the file never changes.
+     * The vector must be empty.
+     * 
+     * @param   path   Path of file
+     */
+    void map_file(const char* path) {
+      static_assert(std::is_trivially_copyable_v<Tp>,
+        "only trivially copyable elements can be mapped");
+      static_assert(sizeof(Tp*)==sizeof(std::uint64_t),
+        "blocks of index are relocated in place");
+      static_assert(Traits::file_map && !Traits::cow,
+        "mapping must be enabled by the traits and unshared");
+#ifdef RSFR_RMV_MMAP
+      auto fd = ::open(path, O_RDONLY);
+      if( fd<0 )
+        throw std::system_error(errno, std::generic_category(), path);
+      struct stat st;
+      if( ::fstat(fd, &st)<0 ) {
+        auto err = errno;
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), path);
+      }
+      auto len = static_cast<size_type>(st.st_size);
+      if( len<sizeof(mvheader) ) {
+        ::close(fd);
+        throw std::runtime_error("rmv: file is not a saved vector");
+      }
+      auto raw = ::mmap(nullptr, len, PROT_READ|PROT_WRITE,
+        MAP_PRIVATE, fd, 0);
+      auto err = errno;
+      ::close(fd);
+      if( raw==MAP_FAILED )
+        throw std::system_error(err, std::generic_category(), path);
+      m_map = {static_cast<std::byte*>(raw), len};
+      mvheader head;
+      std::memcpy(&head, m_map.base, sizeof(head));
+      auto want = header();
+      if( std::memcmp(head.magic, want.magic, sizeof(head.magic))!=0 ||
+          head.order!=want.order || head.elm_size!=want.elm_size ||
+          head.elm_align!=want.elm_align || head.exp!=want.exp ||
+          head.iexp!=want.iexp || head.ptr_size!=want.ptr_size ||
+          head.peek>=max_size() || (head.peek==0)!=(head.root==0) ||
+          (head.peek!=0 && ((head.peek&blk::mask())!=blk::mask() ||
+            head.deep!=max_deep(head.peek) || head.free>blk::mask() ||
+            !valid(head.root, head.deep)))) {
+        unmap();
+        throw std::runtime_error("rmv: file is not a saved vector");
+      }
+      if( head.peek==0 ) {
+        unmap();
+        return;
+      }
+      m_root.val = reinterpret_cast<Tp*>(m_map.base+head.root);
+      m_deep = head.deep;
+      if( !relocate(m_root, m_deep, 0, head.peek) ) {
+        m_root = {};
+        m_deep = 0;
+        unmap();
+        throw std::runtime_error("rmv: file is not a saved vector");
+      }
+      m_peek = static_cast<size_type>(head.peek);
+      m_free = static_cast<mvbsize_type>(head.free);
+      m_tail = rand_block(m_peek);
+#else
+      (void)path;
+      throw std::system_error(std::make_error_code(
+        std::errc::function_not_supported));
+#endif
+    }
+
+  private:
+    struct mvheader {
+      char magic[4];
+      std::uint32_t order;
+      std::uint64_t elm_size;
+      std::uint64_t elm_align;
+      std::uint8_t exp;
+      std::uint8_t iexp;
+      std::uint8_t deep;
+      std::uint8_t ptr_size;
+      std::uint32_t reserved;
+      std::uint64_t peek;
+      std::uint64_t free;
+      std::uint64_t root;
+    };
+
+    // alignment of blocks in file
+    static constexpr size_type file_align =
+      std::max(alignof(Tp), alignof(std::uint64_t));
+
+    mvheader header(void) const noexcept {
+      return {{'R', 'M', 'V', '1'}, 0x01020304u, sizeof(Tp), alignof(Tp),
+        Exp, blk::IExp, m_deep, sizeof(Tp*), 0, m_peek, m_free, 0};
+    }
+
+    // num of levels of index needed by the peek
+    static constexpr mvlsize_type max_deep(std::uint64_t peek) noexcept {
+      mvlsize_type deep = 0;
+      while( peek>end_peek(deep) )
+        ++deep;
+      return deep;
+    }
+
+    std::uint64_t write_tree(std::ofstream& out, mvp root,
+      mvlsize_type lvl, size_type base) const {
+      if( lvl==0 ) {
+        auto off = pad(out);
+        auto n = std::min<size_type>(size()-base, blk::size());
+        out.write(reinterpret_cast<const char*>(root.val),
+          static_cast<std::streamsize>(sizeof(Tp)*n));
+        for(auto i=sizeof(Tp)*n; i<sizeof(Tp)*blk::size(); ++i)
+          out.put(0);
+        return off;
+      }
+      auto offs = std::make_unique<std::uint64_t[]>(blk::isize());
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        if( root.pindex[i]!=nullptr )
+          offs[i] = write_tree(out, {.index=root.pindex[i]}, lvl-1,
+            base+(static_cast<size_type>(i)<<blk::shift(lvl)));
+      }
+      auto off = pad(out);
+      out.write(reinterpret_cast<const char*>(offs.get()),
+        sizeof(std::uint64_t)*blk::isize());
+      return off;
+    }
+
+    static std::uint64_t pad(std::ofstream& out) {
+      auto off = static_cast<std::uint64_t>(out.tellp());
+      for(; off%file_align!=0; ++off)
+        out.put(0);
+      return off;
+    }
+
+    // the block at off fits the mapping
+    bool valid(std::uint64_t off, mvlsize_type lvl) const noexcept {
+      auto len = lvl==0 ? sizeof(Tp)*blk::size() :
+        sizeof(std::uint64_t)*blk::isize();
+      return off>=sizeof(mvheader) && off%file_align==0 &&
+        off<=m_map.len && len<=m_map.len-off;
+    }
+
+    // every block up to the peek must be present
+    bool relocate(mvp root, mvlsize_type lvl,
+      size_type base, std::uint64_t peek) noexcept {
+      if( lvl==0 )
+        return true;
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        auto first = base+(static_cast<size_type>(i)<<blk::shift(lvl));
+        std::uint64_t off;
+        std::memcpy(&off, root.pindex+i, sizeof(off));
+        if( off==0 || first>peek ) {
+          root.pindex[i] = nullptr;
+          if( first<=peek )
+            return false;
+          continue;
+        }
+        if( !valid(off, lvl-1) )
+          return false;
+        root.pindex[i] = reinterpret_cast<Tp**>(m_map.base+off);
+        if( !relocate({.index=root.pindex[i]}, lvl-1, first, peek) )
+          return false;
+      }
+      return true;
+    }
+
+  public:
+    allocator_type get_allocator(void) const noexcept
+      { return allocator_type(m_alloc); }
+
+    void fill(size_type n) {
+      grow(n, [this](Tp* first, size_type count) noexcept(blk::plain &&
+        std::is_nothrow_default_constructible_v<Tp>) {
+        uninit_default(first, count);
+      });
     }
 
     void fill(size_type n, const Tp& val) {
-      auto new_size = size()+n;
-      if( m_free>n ) {
-        std::fill_n(tail_block()+(mvb<Exp, Tp>::size()-m_free), n, val);
-        m_free -= n;
-        return;
-      }
-      std::fill_n(tail_block()+(mvb<Exp, Tp>::size()-m_free), m_free, val);
-      n -= m_free;
-      mvbsize_type nblocks = n>>Exp;
-      fill_blocks(nblocks, val);
-      if( (n&mvb<Exp, Tp>::mask())!=0 )
-        std::fill_n(push_block(), n&mvb<Exp, Tp>::mask(), val);
-      m_free = capacity()-new_size;
+      grow(n, [this, &val](Tp* first, size_type count)
+        noexcept(blk::plain && std::is_nothrow_copy_constructible_v<Tp>) {
+        uninit_fill(first, count, val);
+      });
     }
 
     void reduce(size_type n)
-      noexcept(std::is_nothrow_destructible_v<Tp>) {
+      noexcept(std::is_nothrow_destructible_v<Tp> && !Traits::cow) {
+      // the shared blocks are cloned before they are reduced
+      unshare(size()-n, size());
+      destroy_elms(size()-n, size());
       auto new_size = size()-n;
-      if( mvb<Exp, Tp>::size()-m_free>n ) {
+      if( blk::size()-m_free>n ) {
         m_free += n;
         return;
       }
-      mvbsize_type nblocks = 1;
-      n -= mvb<Exp, Tp>::size()-m_free;
+      size_type nblocks = 1;
+      n -= blk::size()-m_free;
       nblocks += n>>Exp;
       reduce_blocks(nblocks);
       m_free = capacity()-new_size;
@@ -617,18 +2066,84 @@ class mv {
       noexcept(std::is_nothrow_destructible_v<Tp>) {
       if( m_peek==0 )
         return;
+      m_cache.clear();
+      // drop the references of tree
+      if constexpr( Traits::cow ) {
+        release_tree(m_root, m_deep, 0);
+        m_root.index = nullptr;
+        m_tail = nullptr;
+        m_peek = m_deep = m_free = 0;
+        return;
+      }
       // dealloc block of value
       if( m_deep==0 ) {
-        mvb<Exp, Tp>::dlloc(m_root.val);
-        m_root.val = nullptr;
+        destroy_n(m_root.val, blk::size()-m_free);
+        dlloc_root(m_root.val, std::exchange(m_tier, 0));
+        m_root.val = m_tail = nullptr;
         m_peek = m_free = 0;
+        unmap();
         return;
       }
       // destroy the tree
       recursive_destroy(m_root, m_deep);
-      mvb<Exp, Tp>::dlloc(m_root.index);
+      dlloc(m_root.index);
       m_root.index = nullptr;
+      m_tail = nullptr;
       m_peek = m_deep = m_free = 0;
+      unmap();
+    }
+
+    /**
+     * @brief   Discard the vector.
+     * 
+     * Forgets all blocks without returning them to the allocator,
+     * for a vector whose memory is released at once by its arena,
+     * e.g. std::pmr::monotonic_buffer_resource. The elements are
+     * still destroyed unless Tp is trivially destructible, then
+     * the tree is not walked at all.
+     */
+    void discard(void) noexcept(std::is_nothrow_destructible_v<Tp>) {
+      // the shared blocks still belong to the copies
+      if constexpr( Traits::cow ) {
+        destroy();
+        return;
+      }
+      destroy_elms(0, size());
+      m_vpool.discard();
+      m_ipool.discard();
+      m_cache.clear();
+      m_root.index = nullptr;
+      m_tail = nullptr;
+      m_peek = m_deep = m_tier = m_free = 0;
+      unmap();
+    }
+
+    /**
+     * @brief   Save the vector.
+     * 
+     * File layout, all offsets are relative to the begin of file
+     * and zero is the null block:
+     *   header      magic, layout of Tp, Exp, IExp, m_deep,
+     *               m_peek, m_free and offset of root
+     *   blocks      blocks of value and index, children before
+     *               their parent, aligned to the block alignment
+     * A block of index holds the offsets of its children. The
+     * unused elements of the last block of value are zeroed.
+     * 
+     * @param   path   Path of file
+     */
+    void save(const char* path) const {
+      static_assert(std::is_trivially_copyable_v<Tp>,
+        "only trivially copyable elements can be saved");
+      std::ofstream out;
+      out.exceptions(std::ios::failbit|std::ios::badbit);
+      out.open(path, std::ios::binary|std::ios::trunc);
+      auto head = header();
+      out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+      if( m_peek!=0 )
+        head.root = write_tree(out, m_root, m_deep, 0);
+      out.seekp(0);
+      out.write(reinterpret_cast<const char*>(&head), sizeof(head));
     }
 
     bool empty(void) const noexcept
@@ -643,28 +2158,74 @@ class mv {
     static consteval size_type max_exponent(void) noexcept
       { return std::numeric_limits<mvbsize_type>::digits-2; }
 
+    mvstats stats(void) const noexcept { return m_stats.get(); }
+    void reset_stats(void) noexcept { m_stats.reset(); }
+
+    /**
+     * @brief   Memory of blocks.
+     * 
+     * Counted from the shape of the tree, the blocks are packed
+     * to the left, so every level holds the blocks of the level
+     * below divided by the size of block of index, rounded up.
+     */
+    mvmemory memory_stats(void) const noexcept {
+      mvmemory mem{};
+      if( m_peek==0 )
+        return mem;
+      // the inline buffer is inside the vector object
+      if( m_deep==0 && root_size()<blk::size() ) {
+        mem.leaf_blocks = m_tier!=0;
+        mem.leaf_bytes = sizeof(Tp)*root_size()*mem.leaf_blocks;
+        mem.slack_bytes = sizeof(Tp)*(root_size()-size());
+        return mem;
+      }
+      mem.leaf_blocks = (m_peek>>Exp)+1;
+      for(size_type n=mem.leaf_blocks, lvl=0; lvl<m_deep; ++lvl) {
+        n = (n+blk::imask())>>blk::IExp;
+        mem.index_blocks += n;
+      }
+      if constexpr( Traits::cow ) {
+        mem.leaf_bytes = sval::units*sval::align;
+        mem.index_bytes = sindex::units*sindex::align;
+      } else {
+        mem.leaf_bytes = sizeof(Tp)*blk::size();
+        mem.index_bytes = sizeof(Tp*)*blk::isize();
+      }
+      mem.leaf_bytes *= mem.leaf_blocks;
+      mem.index_bytes *= mem.index_blocks;
+      mem.slack_bytes = sizeof(Tp)*m_free;
+      mem.mapped_bytes = m_map.len;
+      return mem;
+    }
+
 ////////////////////////////////////////////////////////////////////////////////
   public:
-    void print_tree(mvp root, mvlsize_type lvl, mvlsize_type deep) const {
+    void print_tree(mvp root, mvlsize_type lvl,
+      mvlsize_type deep, size_type base = 0) const {
       if( root.val==nullptr )
         return;
       for(size_type i=0; i<(size_type)(lvl<<1); ++i)
         std::cout<<" ";
       std::cout<<"|";
       if( lvl==deep ) {
-        // iterating block of value
-        for(mvbsize_type i=0; i<mvb<Exp, Tp>::size(); ++i)
-          std::cout<<root.val[i]<<"|";
+        // iterating block of value, only the elements are printed
+        for(mvbsize_type i=0; i<blk::size(); ++i) {
+          if( base+i<size() )
+            std::cout<<root.val[i];
+          std::cout<<"|";
+        }
         std::cout<<std::endl;
         return;
       }
       // iterating block of index
-      for(mvbsize_type i=0; i<mvb<Exp, Tp>::size(); ++i)
+      for(mvbsize_type i=0; i<blk::isize(); ++i)
         std::cout<<(static_cast<bool>(root.pindex[i]) ? "=" : " ")<<"|";
       std::cout<<std::endl;
       // block of index call each element
-      for(mvbsize_type i=0; i<mvb<Exp, Tp>::size(); ++i)
-        print_tree({.index=root.pindex[i]}, lvl+1, deep);
+      for(mvbsize_type i=0; i<blk::isize(); ++i)
+        print_tree({.index=root.pindex[i]}, lvl+1, deep,
+          base+(static_cast<size_type>(i)<<
+            blk::shift(deep-lvl)));
     }
 ////////////////////////////////////////////////////////////////////////////////
 };
@@ -684,6 +2245,13 @@ class mvi {
   protected:
     difference_type m_pos;
 
+    static constexpr difference_type
+      mask(void) noexcept
+      { return static_cast<difference_type>(V::block_size())-1; }
+    static constexpr bool
+      same_block(difference_type a, difference_type b) noexcept
+      { return (a|mask())==(b|mask()); }
+
   public:
     mvi(void) noexcept : m_pos{} {}
     mvi(difference_type off) noexcept : m_pos{off} {}
@@ -695,10 +2263,21 @@ class mvi {
     bool operator>=(const mvi& it) const noexcept { return m_pos>=it.m_pos; }
 };
 
+template <class V>
+class rmvci;
+
+/**
+ * Iterators keep a pointer to the current element, so stepping
+ * inside a block of value is a plain pointer increment. The tree
+ * is only traversed again when the position crosses the boundary
+ * of a block.
+ */
 template <class V>
 class rmvi : public mvi<V> {
   private:
     using mvi<V>::m_pos;
+    using mvi<V>::mask;
+    using mvi<V>::same_block;
 
   public:
     using value_type = typename mvi<V>::value_type;
@@ -710,35 +2289,73 @@ class rmvi : public mvi<V> {
 
   private:
     V* m_vector;
+    pointer m_elm;
+
+    friend class rmvci<V>;
 
   public:
-    rmvi(void) noexcept = default;
-    rmvi(V* vector) noexcept : m_vector{vector} {}
+    rmvi(void) noexcept : m_vector{}, m_elm{} {}
+    rmvi(V* vector) noexcept :
+      m_vector{vector}, m_elm{vector->locate(0)} {}
     rmvi(V* vector, difference_type off) noexcept :
-      mvi<V>{off}, m_vector{vector} {}
+      mvi<V>{off}, m_vector{vector}, m_elm{vector->locate(off)} {}
 
     reference operator*(void) const noexcept
-      { return (*m_vector)[m_pos]; }
+      { return *m_elm; }
     pointer operator->(void) const noexcept
-      { return &(*m_vector)[m_pos]; }
+      { return m_elm; }
     reference operator[](difference_type off) const noexcept
-      { return (*m_vector)[off]; }
+      { return *(*this+off); }
 
-    rmvi& operator++(void) noexcept { ++m_pos; return *this; }
-    rmvi operator++(int) noexcept { return rmvi(m_vector, m_pos++); }
-    rmvi& operator--(void) noexcept { --m_pos; return *this; }
-    rmvi operator--(int) noexcept { return rmvi(m_vector, m_pos--); }
+    /**
+     * @brief   Contiguous segment.
+     * 
+     * @return  Elements from the current position to the end
+     *          of its block of value, bounded by the size.
+     */
+    std::span<value_type> segment(void) const noexcept {
+      if( m_elm==nullptr )
+        return {};
+      auto n = std::min<difference_type>(mask()+1-(m_pos&mask()),
+        m_vector->end_pos()-m_pos);
+      return {m_elm, static_cast<size_type>(n>0 ? n : 0)};
+    }
 
-    rmvi& operator+=(difference_type off) noexcept
-      { m_pos += off; return *this; }
-    rmvi operator+(difference_type off) const noexcept
-      { return rmvi(m_vector, m_pos+off); }
-    friend rmvi operator+(difference_type off, const rmvi& it) noexcept
-      { return rmvi(it.m_vector, off+it.m_pos); }
+    rmvi& operator++(void) noexcept {
+      if( (++m_pos&mask())!=0 )
+        ++m_elm;
+      else
+        m_elm = m_vector->locate(m_pos);
+      return *this;
+    }
+    rmvi operator++(int) noexcept
+      { auto it = *this; ++*this; return it; }
+    rmvi& operator--(void) noexcept {
+      if( (m_pos--&mask())!=0 )
+        --m_elm;
+      else
+        m_elm = m_vector->locate(m_pos);
+      return *this;
+    }
+    rmvi operator--(int) noexcept
+      { auto it = *this; --*this; return it; }
+
+    rmvi& operator+=(difference_type off) noexcept {
+      if( m_elm!=nullptr && same_block(m_pos, m_pos+off) )
+        m_elm += off;
+      else
+        m_elm = m_vector->locate(m_pos+off);
+      m_pos += off;
+      return *this;
+    }
+    rmvi operator+(difference_type off) const noexcept
+      { auto it = *this; return it += off; }
+    friend rmvi operator+(difference_type off, const rmvi& it) noexcept
+      { return it+off; }
     rmvi& operator-=(difference_type off) noexcept
-      { m_pos -= off; return *this; }
+      { return *this += -off; }
     rmvi operator-(difference_type off) const noexcept
-      { return rmvi(m_vector, m_pos-off); }
+      { auto it = *this; return it += -off; }
     difference_type operator-(const rmvi& it) const noexcept
       { return m_pos-it.m_pos; }
 };
@@ -747,6 +2364,8 @@ template <class V>
 class rmvci : public mvi<V> {
   private:
     using mvi<V>::m_pos;
+    using mvi<V>::mask;
+    using mvi<V>::same_block;
 
   public:
     using value_type = typename mvi<V>::value_type;
@@ -758,135 +2377,599 @@ class rmvci : public mvi<V> {
 
   private:
     const V* m_vector;
+    pointer m_elm;
 
   public:
-    rmvci(void) noexcept = default;
-    rmvci(const V* vector) noexcept : m_vector{vector} {}
+    rmvci(void) noexcept : m_vector{}, m_elm{} {}
+    rmvci(const V* vector) noexcept :
+      m_vector{vector}, m_elm{vector->locate(0)} {}
     rmvci(const V* vector, difference_type off) noexcept :
-      mvi<V>{off}, m_vector{vector} {}
+      mvi<V>{off}, m_vector{vector}, m_elm{vector->locate(off)} {}
+    rmvci(const rmvi<V>& it) noexcept :
+      mvi<V>{it.m_pos}, m_vector{it.m_vector}, m_elm{it.m_elm} {}
 
     reference operator*(void) const noexcept
-      { return (*m_vector)[m_pos]; }
+      { return *elm(); }
     pointer operator->(void) const noexcept
-      { return &(*m_vector)[m_pos]; }
+      { return elm(); }
     reference operator[](difference_type off) const noexcept
-      { return (*m_vector)[off]; }
+      { return *(*this+off); }
+
+    /**
+     * @brief   Contiguous segment.
+     * 
+     * @return  Elements from the current position to the end
+     *          of its block of value, bounded by the size.
+     */
+    std::span<const value_type> segment(void) const noexcept {
+      auto p = elm();
+      if( p==nullptr )
+        return {};
+      auto n = std::min<difference_type>(mask()+1-(m_pos&mask()),
+        m_vector->end_pos()-m_pos);
+      return {p, static_cast<size_type>(n>0 ? n : 0)};
+    }
 
-    rmvci& operator++(void) noexcept { ++m_pos; return *this; }
-    rmvci operator++(int) noexcept { return rmvci(m_vector, m_pos++); }
-    rmvci& operator--(void) noexcept { --m_pos; return *this; }
-    rmvci operator--(int) noexcept { return rmvci(m_vector, m_pos--); }
+    rmvci& operator++(void) noexcept {
+      if( (++m_pos&mask())!=0 && m_elm!=nullptr )
+        ++m_elm;
+      else
+        m_elm = m_vector->locate(m_pos);
+      return *this;
+    }
+    rmvci operator++(int) noexcept
+      { auto it = *this; ++*this; return it; }
+    rmvci& operator--(void) noexcept {
+      if( (m_pos--&mask())!=0 && m_elm!=nullptr )
+        --m_elm;
+      else
+        m_elm = m_vector->locate(m_pos);
+      return *this;
+    }
+    rmvci operator--(int) noexcept
+      { auto it = *this; --*this; return it; }
 
-    rmvci& operator+=(difference_type off) noexcept
-      { m_pos += off; return *this; }
+    rmvci& operator+=(difference_type off) noexcept {
+      if( m_elm!=nullptr && same_block(m_pos, m_pos+off) )
+        m_elm += off;
+      else
+        m_elm = m_vector->locate(m_pos+off);
+      m_pos += off;
+      return *this;
+    }
     rmvci operator+(difference_type off) const noexcept
-      { return rmvci(m_vector, m_pos+off); }
+      { auto it = *this; return it += off; }
     friend rmvci operator+(difference_type off, const rmvci& it) noexcept
-      { return rmvci(it.m_vector, off+it.m_pos); }
+      { return it+off; }
     rmvci& operator-=(difference_type off) noexcept
-      { m_pos -= off; return *this; }
+      { return *this += -off; }
     rmvci operator-(difference_type off) const noexcept
-      { return rmvci(m_vector, m_pos-off); }
+      { auto it = *this; return it += -off; }
     difference_type operator-(const rmvci& it) const noexcept
       { return m_pos-it.m_pos; }
+
+  private:
+    // a position past the size when the iterator was made has no
+    // element yet, it is located again once the vector grew, e.g.
+    // by the appends of concurrent_rpmv
+    pointer elm(void) const noexcept
+      { return m_elm!=nullptr ? m_elm : m_vector->locate(m_pos); }
 };
 
-template <std::uint8_t Exp, class Tp>
-class rpmv : protected mv<Exp, Tp> {
+template <std::uint8_t Exp, class Tp, class Traits = mvtraits,
+  class Alloc = std::allocator<Tp>>
+class rpmv : protected mv<Exp, Tp, Traits, Alloc> {
   private:
-    using mv<Exp, Tp>::m_root;
-    using mv<Exp, Tp>::m_peek;
-    using mv<Exp, Tp>::m_deep;
-    using mv<Exp, Tp>::m_free;
-
-    using mv<Exp, Tp>::end_size;
-    using mv<Exp, Tp>::end_peek;
-    using mv<Exp, Tp>::fill_blocks;
-    using mv<Exp, Tp>::reduce_blocks;
-    using mv<Exp, Tp>::push_block;
-    using mv<Exp, Tp>::head_block;
-    using mv<Exp, Tp>::rand_block;
-    using mv<Exp, Tp>::tail_block;
-    using mv<Exp, Tp>::pop_block;
-
-    using mvlsize_type = typename mvb<Exp, Tp>::mvlsize_type;
-    using mvldiff_type = typename mvb<Exp, Tp>::mvldiff_type;
-    using mvbsize_type = typename mvb<Exp, Tp>::mvbsize_type;
-    using mvbdiff_type = typename mvb<Exp, Tp>::mvbdiff_type;
+    using mv<Exp, Tp, Traits, Alloc>::m_root;
+    using mv<Exp, Tp, Traits, Alloc>::m_peek;
+    using mv<Exp, Tp, Traits, Alloc>::m_deep;
+    using mv<Exp, Tp, Traits, Alloc>::m_free;
+    using mv<Exp, Tp, Traits, Alloc>::m_alloc;
+
+    using mv<Exp, Tp, Traits, Alloc>::end_size;
+    using mv<Exp, Tp, Traits, Alloc>::end_peek;
+    using mv<Exp, Tp, Traits, Alloc>::fill_blocks;
+    using mv<Exp, Tp, Traits, Alloc>::reduce_blocks;
+    using mv<Exp, Tp, Traits, Alloc>::push_block;
+    using mv<Exp, Tp, Traits, Alloc>::head_block;
+    using mv<Exp, Tp, Traits, Alloc>::rand_block;
+    using mv<Exp, Tp, Traits, Alloc>::tail_block;
+    using mv<Exp, Tp, Traits, Alloc>::cache_block;
+    using mv<Exp, Tp, Traits, Alloc>::batch_blocks;
+    using mv<Exp, Tp, Traits, Alloc>::batch;
+    using mv<Exp, Tp, Traits, Alloc>::find_block;
+    using mv<Exp, Tp, Traits, Alloc>::pop_block;
+    using mv<Exp, Tp, Traits, Alloc>::grow;
+    using mv<Exp, Tp, Traits, Alloc>::rshift;
+    using mv<Exp, Tp, Traits, Alloc>::lshift;
+    using mv<Exp, Tp, Traits, Alloc>::for_segments;
+    using mv<Exp, Tp, Traits, Alloc>::construct;
+    using mv<Exp, Tp, Traits, Alloc>::destroy_n;
+    using mv<Exp, Tp, Traits, Alloc>::uninit_fill;
+    using mv<Exp, Tp, Traits, Alloc>::uninit_copy;
+    using mv<Exp, Tp, Traits, Alloc>::steal;
+    using mv<Exp, Tp, Traits, Alloc>::purge;
+    using mv<Exp, Tp, Traits, Alloc>::swap_blocks;
+    using mv<Exp, Tp, Traits, Alloc>::write_block;
+    using mv<Exp, Tp, Traits, Alloc>::unshare;
+    using mv<Exp, Tp, Traits, Alloc>::own_tail;
+    using mv<Exp, Tp, Traits, Alloc>::leave_root;
+    using mv<Exp, Tp, Traits, Alloc>::spill_root;
+    using mv<Exp, Tp, Traits, Alloc>::enter_root;
+    using mv<Exp, Tp, Traits, Alloc>::share_tree;
+
+    using blk = mvb<Exp, Tp, Traits, Alloc>;
+    using alloc_traits = std::allocator_traits<Alloc>;
+    using mvlsize_type = typename blk::mvlsize_type;
+    using mvldiff_type = typename blk::mvldiff_type;
+    using mvbsize_type = typename blk::mvbsize_type;
+    using mvbdiff_type = typename blk::mvbdiff_type;
 
   public:
-    using mv<Exp, Tp>::fill;
-    using mv<Exp, Tp>::reduce;
-    using mv<Exp, Tp>::destroy;
-    using mv<Exp, Tp>::empty;
-    using mv<Exp, Tp>::capacity;
-    using mv<Exp, Tp>::size;
-    using mv<Exp, Tp>::max_size;
-    using mv<Exp, Tp>::max_exponent;
-
-    using value_type = typename mvb<Exp, Tp>::value_type;
-    using reference = typename mvb<Exp, Tp>::reference;
-    using const_reference = typename mvb<Exp, Tp>::const_reference;
-    using pointer = typename mvb<Exp, Tp>::pointer;
-    using const_pointer = typename mvb<Exp, Tp>::const_pointer;
-    using size_type = typename mvb<Exp, Tp>::size_type;
-    using difference_type = typename mvb<Exp, Tp>::difference_type;
-    using iterator = rmvi<rpmv<Exp, Tp>>;
-    using const_iterator = rmvci<rpmv<Exp, Tp>>;
+    using mv<Exp, Tp, Traits, Alloc>::fill;
+    using mv<Exp, Tp, Traits, Alloc>::reduce;
+    using mv<Exp, Tp, Traits, Alloc>::destroy;
+    using mv<Exp, Tp, Traits, Alloc>::discard;
+    using mv<Exp, Tp, Traits, Alloc>::get_allocator;
+    using mv<Exp, Tp, Traits, Alloc>::save;
+    using mv<Exp, Tp, Traits, Alloc>::empty;
+    using mv<Exp, Tp, Traits, Alloc>::capacity;
+    using mv<Exp, Tp, Traits, Alloc>::size;
+    using mv<Exp, Tp, Traits, Alloc>::max_size;
+    using mv<Exp, Tp, Traits, Alloc>::max_exponent;
+    using mv<Exp, Tp, Traits, Alloc>::stats;
+    using mv<Exp, Tp, Traits, Alloc>::reset_stats;
+    using mv<Exp, Tp, Traits, Alloc>::memory_stats;
+
+    using value_type = typename blk::value_type;
+    using reference = typename blk::reference;
+    using const_reference = typename blk::const_reference;
+    using pointer = typename blk::pointer;
+    using const_pointer = typename blk::const_pointer;
+    using size_type = typename blk::size_type;
+    using difference_type = typename blk::difference_type;
+    using allocator_type = Alloc;
+    using traits_type = Traits;
+    using iterator = rmvi<rpmv>;
+    using const_iterator = rmvci<rpmv>;
     using reverse_iterator = std::reverse_iterator<iterator>;
     using const_reverse_iterator = std::reverse_iterator<const_iterator>;
 
 ////////////////////////////////////////////////////////////////////////////////
   public:
-    using mv<Exp, Tp>::rmv_testing;
+    using mv<Exp, Tp, Traits, Alloc>::rmv_testing;
     void rpmv_testing(void) {
       std::cout<<"rpmv_testing()"<<std::endl;
     }
 ////////////////////////////////////////////////////////////////////////////////
 
   public:
-    rpmv(void) noexcept {}
-    rpmv(size_type num) : rpmv{} { fill(num); }
-    rpmv(size_type num, const Tp& val) : rpmv{} { fill(num, val); }
+    friend iterator;
+    friend const_iterator;
+
+  public:
+    rpmv(void) noexcept(noexcept(Alloc())) : rpmv{Alloc()} {}
+    explicit rpmv(const Alloc& alloc) noexcept :
+      mv<Exp, Tp, Traits, Alloc>{alloc} {}
+    rpmv(size_type num, const Alloc& alloc = Alloc()) :
+      rpmv{alloc} { fill(num); }
+    rpmv(size_type num, const Tp& val, const Alloc& alloc = Alloc()) :
+      rpmv{alloc} { fill(num, val); }
+
+    rpmv(const rpmv& other) : rpmv{other, alloc_traits::
+      select_on_container_copy_construction(other.get_allocator())} {}
+    /**
+     * A copy-on-write vector shares the tree of other in O(1),
+     * if the allocators are equal.
+     */
+    rpmv(const rpmv& other, const Alloc& alloc) : rpmv{alloc} {
+      if constexpr( Traits::cow ) {
+        if( m_alloc==other.m_alloc ) {
+          share_tree(other);
+          return;
+        }
+      }
+      try {
+        other.for_segments(0, other.size(),
+          [this](const Tp* elm, size_type count) {
+            append(elm, elm+count);
+          });
+      } catch(...) {
+        destroy();
+        throw;
+      }
+    }
+
+    rpmv(rpmv&& other) noexcept : rpmv{Alloc(other.m_alloc)}
+      { steal(other); }
+    rpmv(rpmv&& other, const Alloc& alloc) : rpmv{alloc} {
+      if( m_alloc==other.m_alloc )
+        steal(other);
+      else
+        move_from(other);
+    }
+
     ~rpmv(void) noexcept(std::is_nothrow_destructible_v<Tp>) { destroy(); }
 
+    /**
+     * The allocator follows the propagation traits of Alloc, if
+     * it stays and differs from the one of other, the elements are
+     * copied or moved one by one, otherwise the blocks are taken.
+     */
+    rpmv& operator=(const rpmv& other) {
+      if( this==&other )
+        return *this;
+      if constexpr( alloc_traits::
+          propagate_on_container_copy_assignment::value ) {
+        if( m_alloc!=other.m_alloc ) {
+          destroy();
+          steal_alloc(other.m_alloc);
+        } else
+          m_alloc = other.m_alloc;
+      }
+      if constexpr( Traits::cow ) {
+        if( m_alloc==other.m_alloc ) {
+          destroy();
+          share_tree(other);
+          return *this;
+        }
+      }
+      assign(other.begin(), other.end());
+      return *this;
+    }
+
+    rpmv& operator=(rpmv&& other) noexcept(
+      alloc_traits::propagate_on_container_move_assignment::value ||
+      alloc_traits::is_always_equal::value) {
+      if( this==&other )
+        return *this;
+      if constexpr( alloc_traits::
+          propagate_on_container_move_assignment::value ) {
+        destroy();
+        steal_alloc(other.m_alloc);
+        steal(other);
+      } else {
+        if( m_alloc==other.m_alloc ) {
+          destroy();
+          steal(other);
+        } else {
+          clear();
+          move_from(other);
+        }
+      }
+      return *this;
+    }
+
+    void swap(rpmv& other) noexcept {
+      if constexpr( alloc_traits::propagate_on_container_swap::value ) {
+        using std::swap;
+        swap(m_alloc, other.m_alloc);
+      }
+      swap_blocks(other);
+    }
+
+    friend void swap(rpmv& a, rpmv& b) noexcept { a.swap(b); }
+
+    /**
+     * @brief   Open a saved vector.
+     * 
+     * The elements are served from the mapping of file without
+     * copying, see save() and map_file() of mv. The traits must
+     * set file_map.
+     * 
+     * @param   path    Path of file
+     * @param   alloc   Allocator of blocks added later
+     */
+    static rpmv open_mapped(const char* path,
+      const Alloc& alloc = Alloc()) {
+      rpmv vec{alloc};
+      vec.map_file(path);
+      return vec;
+    }
+
     void clear(void)
       noexcept(std::is_nothrow_destructible_v<Tp>) { destroy(); }
-  
-  private:
-    template <class Val>
-    void push_elm(Val val) {
+
+    /**
+     * @brief   Append range.
+     * 
+     * The blocks are allocated in one pass, then the elements are
+     * copied block by block, with memcpy if Tp is trivially
+     * copyable and the range is contiguous.
+     * 
+     * @param   first   Begin of range
+     * @param   last    End of range
+     */
+    template <std::input_iterator It>
+    void append(It first, It last) {
+      if constexpr( std::forward_iterator<It> ) {
+        grow(static_cast<size_type>(std::distance(first, last)),
+          [this, &first](Tp* dst, size_type count) {
+            first = uninit_copy(first, count, dst);
+          });
+      } else {
+        for(; first!=last; ++first)
+          emplace_back(*first);
+      }
+    }
+
+    void append(std::span<const Tp> elms)
+      { append(elms.begin(), elms.end()); }
+
+    /**
+     * @brief   Assign range.
+     * 
+     * The elements are overwritten block by block, then the rest
+     * of range is appended or the rest of vector is reduced.
+     * 
+     * @param   first   Begin of range
+     * @param   last    End of range
+     */
+    template <std::input_iterator It>
+    void assign(It first, It last) {
+      if constexpr( std::forward_iterator<It> ) {
+        auto n = static_cast<size_type>(std::distance(first, last));
+        auto m = std::min(n, size());
+        for(size_type i=0; i<m;) {
+          auto seg = segment(i);
+          seg = seg.first(std::min(seg.size(), m-i));
+          first = std::ranges::copy_n(first, seg.size(), seg.begin()).in;
+          i += seg.size();
+        }
+        if( n<size() )
+          reduce(size()-n);
+        else
+          append(first, last);
+      } else {
+        clear();
+        for(; first!=last; ++first)
+          emplace_back(*first);
+      }
+    }
+
+    /**
+     * @brief   Insert elements.
+     * 
+     * The elements after pos are shifted block by block, the
+     * vector grows through fill_blocks().
+     * 
+     * @param   pos   Position of insertion
+     * @param   n     Num of elements
+     * @param   val   Value of elements
+     * 
+     * @return  Iterator of the first inserted element.
+     */
+    iterator insert(const_iterator pos, size_type n, const Tp& val) {
+      auto i = static_cast<size_type>(pos-cbegin());
+      // val may be an element of the vector
+      Tp elm(val);
+      rshift(i, n, [this, &elm](Tp* first, size_type count) {
+        uninit_fill(first, count, elm);
+      }, [&elm](Tp* first, size_type count) {
+        std::fill_n(first, count, elm);
+      });
+      return begin()+i;
+    }
+
+    iterator insert(const_iterator pos, const Tp& val)
+      { return insert(pos, 1, val); }
+
+    template <std::input_iterator It>
+    iterator insert(const_iterator pos, It first, It last) {
+      auto i = static_cast<size_type>(pos-cbegin());
+      if constexpr( std::forward_iterator<It> ) {
+        auto n = static_cast<size_type>(std::distance(first, last));
+        // elements of range which go beyond the old size
+        auto mid = first;
+        if( size()-i<n )
+          std::advance(mid, size()-i);
+        rshift(i, n, [this, &mid](Tp* elm, size_type count) {
+          mid = uninit_copy(mid, count, elm);
+        }, [&first](Tp* elm, size_type count) {
+          first = std::ranges::copy_n(first, count, elm).in;
+        });
+      } else {
+        auto old_size = size();
+        append(first, last);
+        std::rotate(begin()+i, begin()+old_size, end());
+      }
+      return begin()+i;
+    }
+
+    /**
+     * @brief   Erase elements.
+     * 
+     * The elements after last are shifted block by block, the
+     * vector shrinks through reduce_blocks().
+     * 
+     * @param   first   Begin of range
+     * @param   last    End of range
+     * 
+     * @return  Iterator of the element after the erased ones.
+     */
+    iterator erase(const_iterator first, const_iterator last) {
+      auto i = static_cast<size_type>(first-cbegin());
+      lshift(i, static_cast<size_type>(last-first));
+      return begin()+i;
+    }
+
+    iterator erase(const_iterator pos)
+      { return erase(pos, pos+1); }
+
+    template <class... Args>
+    reference emplace_back(Args&&... args) {
+      if( auto old = leave_root(1); old.block!=nullptr ) {
+        Tp* elm;
+        try {
+          elm = construct(own_tail()+(blk::size()-m_free),
+            std::forward<Args>(args)...);
+        } catch(...) {
+          enter_root(old);
+          throw;
+        }
+        spill_root(old, size());
+        --m_free;
+        return *elm;
+      }
       if( m_free>0 ) {
-        (*this)[m_peek-(--m_free)] = std::forward<Val>(val);
-        return;
+        auto elm = construct(own_tail()+
+          (blk::size()-m_free), std::forward<Args>(args)...);
+        --m_free;
+        return *elm;
       }
-      push_block()[0] = std::forward<Val>(val);
-      m_free = mvb<Exp, Tp>::mask();
+      auto block = push_block();
+      try {
+        construct(block, std::forward<Args>(args)...);
+      } catch(...) {
+        pop_block();
+        throw;
+      }
+      m_free = blk::mask();
+      return *block;
     }
 
-  public:
-    void push_back(const Tp& val) { push_elm(val); }
-    void push_back(Tp&& val) { push_elm(std::move(val)); }
+    void push_back(const Tp& val) { emplace_back(val); }
+    void push_back(Tp&& val) { emplace_back(std::move(val)); }
     void pop_back(void)
-      noexcept(std::is_nothrow_destructible_v<Tp>) {
-      if( (m_free++)!=mvb<Exp, Tp>::mask() )
+      noexcept(std::is_nothrow_destructible_v<Tp> && !Traits::cow) {
+      destroy_n(own_tail()+(blk::mask()-m_free), 1);
+      if( (m_free++)!=blk::mask() )
         return;
       pop_block();
       m_free = 0;
     }
 
-    reference operator[](size_type index) noexcept
-      { return rand_block(index)[mvb<Exp, Tp>::jump(0, index)]; }
+    reference operator[](size_type index) noexcept(!Traits::cow) {
+      if constexpr( Traits::cow )
+        return write_block(index)[blk::jump(0, index)];
+      else
+        return cache_block(index)[blk::jump(0, index)];
+    }
     const_reference operator[](size_type index) const noexcept 
-      { return rand_block(index)[mvb<Exp, Tp>::jump(0, index)]; }
-    reference front(void) noexcept
-      { return head_block()[0]; }
+      { return cache_block(index)[blk::jump(0, index)]; }
+    reference front(void) noexcept(!Traits::cow)
+      { return write_block(0)[0]; }
     const_reference front(void) const noexcept
       { return head_block()[0]; }
-    reference back(void) noexcept
-      { return tail_block()[mvb<Exp, Tp>::jump(0, m_peek-m_free)]; }
+    reference back(void) noexcept(!Traits::cow)
+      { return own_tail()[blk::mask()-m_free]; }
     const_reference back(void) const noexcept
-      { return tail_block()[mvb<Exp, Tp>::jump(0, m_peek-m_free)]; }
+      { return tail_block()[blk::mask()-m_free]; }
+
+    static consteval size_type block_size(void) noexcept
+      { return blk::size(); }
+
+    /**
+     * @brief   Gather elements.
+     * 
+     * Faster than operator[] for many random positions, they are
+     * resolved in batches, see batch_blocks().
+     * 
+     * @param   idx   Positions, each below the size
+     * @param   out   Receives the element of each position
+     */
+    void gather(std::span<const size_type> idx, Tp* out) const
+      noexcept(std::is_nothrow_copy_assignable_v<Tp>) {
+      Tp* blocks[batch];
+      for(size_type k=0; k<idx.size(); k+=batch) {
+        auto n = std::min(batch, idx.size()-k);
+        batch_blocks(idx.data()+k, n, blocks);
+        for(size_type j=0; j<n; ++j)
+          out[k+j] = blocks[j][blk::jump(0, idx[k+j])];
+      }
+    }
+
+    /**
+     * @brief   Scatter elements.
+     * 
+     * Same as gather(), but assigns the values to the positions in
+     * order, so the last of repeated positions wins. A copy-on-write
+     * vector writes one position at a time, as the shared blocks
+     * are cloned on the way down.
+     * 
+     * @param   idx      Positions, each below the size
+     * @param   values   Value of each position
+     */
+    void scatter(std::span<const size_type> idx,
+      std::span<const Tp> values) {
+      if constexpr( Traits::cow ) {
+        for(size_type k=0; k<idx.size(); ++k)
+          write_block(idx[k])[blk::jump(0, idx[k])] = values[k];
+      } else {
+        Tp* blocks[batch];
+        for(size_type k=0; k<idx.size(); k+=batch) {
+          auto n = std::min(batch, idx.size()-k);
+          batch_blocks(idx.data()+k, n, blocks);
+          for(size_type j=0; j<n; ++j)
+            blocks[j][blk::jump(0, idx[k+j])] = values[k+j];
+        }
+      }
+    }
+
+    /**
+     * @brief   Contiguous segment.
+     * 
+     * @param   index   Position of element
+     * 
+     * @return  Elements from index to the end of its block of
+     *          value, bounded by the size.
+     */
+    std::span<Tp> segment(size_type index) noexcept(!Traits::cow) {
+      if( index>=size() )
+        return {};
+      return {write_block(index)+blk::jump(0, index),
+        std::min<size_type>(block_size()-blk::jump(0, index),
+          size()-index)};
+    }
+    std::span<const Tp> segment(size_type index) const noexcept {
+      if( index>=size() )
+        return {};
+      return {rand_block(index)+blk::jump(0, index),
+        std::min<size_type>(block_size()-blk::jump(0, index),
+          size()-index)};
+    }
+
+  private:
+    // the vector must be empty, the slabs of the block pools go
+    // back to the old allocator
+    void steal_alloc(const typename blk::val_alloc& alloc) noexcept {
+      purge();
+      m_alloc = alloc;
+    }
+
+    void move_from(rpmv& other) {
+      other.unshare(0, other.size());
+      other.for_segments(0, other.size(),
+        [this](Tp* elm, size_type count) {
+          append(std::make_move_iterator(elm),
+            std::make_move_iterator(elm+count));
+        });
+      other.clear();
+    }
+
+    // iterators hold the positions of elements
+    difference_type end_pos(void) const noexcept
+      { return static_cast<difference_type>(size()); }
+
+    pointer locate(difference_type index) const noexcept {
+      auto block = find_block(index);
+      if( block==nullptr )
+        return nullptr;
+      return block+blk::jump(0, static_cast<size_type>(index));
+    }
+
+    // iterator writes through the block of copy-on-write vector
+    pointer locate(difference_type index) {
+      if constexpr( Traits::cow ) {
+        if( find_block(index)==nullptr )
+          return nullptr;
+        auto i = static_cast<size_type>(index);
+        return write_block(i)+blk::jump(0, i);
+      } else
+        return std::as_const(*this).locate(index);
+    }
+
+  public:
 
     iterator begin(void) noexcept
       { return iterator(this); }
@@ -925,13 +3008,1872 @@ class rpmv : protected mv<Exp, Tp> {
       std::cout<<"max      = "<<(size_type)end_peek(m_deep+1)<<std::endl;
       std::cout<<"root     = "<<m_root.val<<std::endl<<std::endl;
 #ifdef RMV_DEBUG
-      mv<Exp, Tp>::print_tree(m_root, 0, m_deep);
+      mv<Exp, Tp, Traits, Alloc>::print_tree(m_root, 0, m_deep);
 #endif
       std::cout<<std::endl;
     }
 ////////////////////////////////////////////////////////////////////////////////
 };
 
+/**
+ * Concurrent append-only multilevel vector.
+ * 
+ * Producers reserve slots with a fetch-add, the missing blocks of
+ * index and value are installed with CAS, and a taller root is
+ * published together with its height in one word. A producer marks
+ * its slot in the commit bitmap behind the block of value, and the
+ * producer which finds the committed prefix ending at its slot
+ * advances size() over the run of marked slots, so size() is always
+ * a prefix of constructed elements and producers never wait on each
+ * other. Readers index the prefix without locking. Blocks never
+ * move, so a published element stays put until the vector is
+ * destroyed.
+ * 
+ * A reserved slot must be published, so the elements are built
+ * by nothrow constructors, and the block of a slot is allocated
+ * before the slot is taken, a failed allocation throws and leaves
+ * the vector unchanged. reserve() allocates the blocks beforehand.
+ */
+template <std::uint8_t Exp, class Tp, class Traits = mvtraits,
+  class Alloc = std::allocator<Tp>>
+class concurrent_rpmv {
+  private:
+    using blk = mvb<Exp, Tp, Traits, Alloc>;
+    using mvlsize_type = typename blk::mvlsize_type;
+    using mvbsize_type = typename blk::mvbsize_type;
+    using node = std::atomic<void*>;
+    using word_type = std::uint64_t;
+
+    // the height lives in the low bits of root
+    static constexpr std::size_t root_align = 64;
+    static constexpr std::size_t word_bits = 64;
+
+    struct alignas(root_align) unit {
+      std::byte bytes[root_align];
+    };
+
+    using unit_alloc = typename std::allocator_traits<Alloc>::
+      template rebind_alloc<unit>;
+    using unit_traits = std::allocator_traits<unit_alloc>;
+
+    // block of value, followed by its position and commit bitmap
+    struct footer {
+      std::size_t first;
+      std::atomic<word_type> bits[(blk::size()+word_bits-1)/word_bits];
+    };
+
+    static constexpr std::size_t foot =
+      (sizeof(Tp)*blk::size()+alignof(footer)-1)/alignof(footer)*
+        alignof(footer);
+    static constexpr std::size_t units =
+      (sizeof(node)*blk::isize()+root_align-1)/root_align;
+    static constexpr std::size_t val_units =
+      (foot+sizeof(footer)+root_align-1)/root_align;
+
+  public:
+    using value_type = typename blk::value_type;
+    using reference = typename blk::reference;
+    using const_reference = typename blk::const_reference;
+    using pointer = typename blk::pointer;
+    using const_pointer = typename blk::const_pointer;
+    using size_type = typename blk::size_type;
+    using difference_type = typename blk::difference_type;
+    using allocator_type = Alloc;
+    using const_iterator = rmvci<concurrent_rpmv>;
+
+    friend const_iterator;
+
+  private:
+    std::atomic<std::uintptr_t> m_root;
+    // last block of value reached by a producer
+    std::atomic<Tp*> m_last;
+    alignas(root_align) std::atomic<size_type> m_reserved;
+    alignas(root_align) std::atomic<size_type> m_size;
+    [[no_unique_address]] typename blk::val_alloc m_alloc;
+
+  public:
+    concurrent_rpmv(void) noexcept(noexcept(Alloc())) :
+      concurrent_rpmv{Alloc()} {}
+    explicit concurrent_rpmv(const Alloc& alloc) noexcept :
+      m_root{}, m_last{}, m_reserved{}, m_size{}, m_alloc(alloc) {}
+    concurrent_rpmv(const concurrent_rpmv&) = delete;
+    concurrent_rpmv& operator=(const concurrent_rpmv&) = delete;
+
+    // no producer or reader may run anymore
+    ~concurrent_rpmv(void) noexcept {
+      static_assert(std::is_nothrow_destructible_v<Tp>,
+        "elements must be nothrow destructible");
+      auto word = m_root.load(std::memory_order_acquire);
+      if( word!=0 )
+        release(node_of(word), deep_of(word), 0);
+    }
+
+    allocator_type get_allocator(void) const noexcept
+      { return allocator_type(m_alloc); }
+
+    /**
+     * @brief   Append element.
+     * 
+     * The block of the next slot is allocated first, then the slot
+     * is taken if no other producer took it meanwhile, so a throw
+     * of the allocator leaves no slot behind.
+     * 
+     * @return  Position of the element.
+     */
+    template <class... Args>
+    size_type emplace_back(Args&&... args) {
+      static_assert(std::is_nothrow_constructible_v<Tp, Args...>,
+        "elements must be built by nothrow constructors");
+      auto i = m_reserved.load(std::memory_order_relaxed);
+      for(;;) {
+        auto elms = leaf(i);
+        if( m_reserved.compare_exchange_weak(i, i+1,
+            std::memory_order_relaxed) ) {
+          blk::val_traits::construct(m_alloc, elms+blk::jump(0, i),
+            std::forward<Args>(args)...);
+          commit(elms, i);
+          return i;
+        }
+      }
+    }
+
+    size_type push_back(const Tp& val)
+      { return emplace_back(val); }
+    size_type push_back(Tp&& val)
+      { return emplace_back(std::move(val)); }
+
+    // allocate the blocks for n elements
+    void reserve(size_type n) {
+      for(size_type i=0; i<n; i+=blk::size())
+        leaf(i);
+    }
+
+    const_reference operator[](size_type index) const noexcept
+      { return *locate(static_cast<difference_type>(index)); }
+
+    size_type size(void) const noexcept
+      { return m_size.load(std::memory_order_acquire); }
+    bool empty(void) const noexcept
+      { return size()==0; }
+    static consteval size_type block_size(void) noexcept
+      { return blk::size(); }
+
+    // end() is the size when it is made, begin() stays valid while
+    // the vector grows, so a range of both is always published
+    const_iterator begin(void) const noexcept
+      { return cbegin(); }
+    const_iterator cbegin(void) const noexcept
+      { return const_iterator(this); }
+    const_iterator end(void) const noexcept
+      { return cend(); }
+    const_iterator cend(void) const noexcept
+      { return const_iterator(this, static_cast<difference_type>(size())); }
+
+    // the elements published now, begin and end of one size()
+    std::ranges::subrange<const_iterator> snapshot(void) const noexcept {
+      auto n = static_cast<difference_type>(size());
+      return {const_iterator(this), const_iterator(this, n)};
+    }
+
+  private:
+    static node* node_of(std::uintptr_t word) noexcept
+      { return reinterpret_cast<node*>(word&~(root_align-1)); }
+    static mvlsize_type deep_of(std::uintptr_t word) noexcept
+      { return static_cast<mvlsize_type>(word&(root_align-1)); }
+    static constexpr size_type
+      end_size(mvlsize_type deep) noexcept
+      { return static_cast<size_type>(1)<<blk::shift(deep+1); }
+    static footer& footer_of(Tp* block) noexcept {
+      return *std::launder(reinterpret_cast<footer*>(
+        reinterpret_cast<std::byte*>(block)+foot));
+    }
+
+    node* alloc_index(void) {
+      unit_alloc ualloc(m_alloc);
+      auto block = reinterpret_cast<node*>(
+        unit_traits::allocate(ualloc, units));
+      for(mvbsize_type i=0; i<blk::isize(); ++i)
+        ::new(block+i) node(nullptr);
+      return block;
+    }
+
+    void dlloc(node* block) noexcept {
+      unit_alloc ualloc(m_alloc);
+      std::destroy_n(block, blk::isize());
+      unit_traits::deallocate(ualloc, reinterpret_cast<unit*>(block),
+        units);
+    }
+
+    Tp* alloc_val(size_type first) {
+      unit_alloc ualloc(m_alloc);
+      auto block = reinterpret_cast<Tp*>(
+        unit_traits::allocate(ualloc, val_units));
+      ::new(reinterpret_cast<std::byte*>(block)+foot)
+        footer{first, {}};
+      return block;
+    }
+
+    void dlloc(Tp* block) noexcept {
+      unit_alloc ualloc(m_alloc);
+      footer_of(block).~footer();
+      unit_traits::deallocate(ualloc, reinterpret_cast<unit*>(block),
+        val_units);
+    }
+
+    // install block into an empty slot, or take the one of winner
+    template <class Make, class Drop>
+    static void* install(node& slot, Make make, Drop drop) {
+      auto block = slot.load(std::memory_order_acquire);
+      if( block!=nullptr )
+        return block;
+      void* fresh = make();
+      if( slot.compare_exchange_strong(block, fresh,
+          std::memory_order_acq_rel, std::memory_order_acquire) )
+        return fresh;
+      drop(fresh);
+      return block;
+    }
+
+    /**
+     * @brief   Block of value of position i.
+     * 
+     * Takes the last block reached when it holds i, otherwise
+     * grows the height until the root covers i, then installs the
+     * missing blocks on the path.
+     */
+    Tp* leaf(size_type i) {
+      auto first = i&~static_cast<size_type>(blk::mask());
+      auto last = m_last.load(std::memory_order_acquire);
+      if( last!=nullptr && footer_of(last).first==first )
+        return last;
+      auto word = m_root.load(std::memory_order_acquire);
+      for(;;) {
+        auto deep = deep_of(word);
+        if( word!=0 && i<end_size(deep) )
+          break;
+        // a taller root holds the old one as its first child
+        auto block = alloc_index();
+        block[0].store(node_of(word), std::memory_order_relaxed);
+        auto grown = reinterpret_cast<std::uintptr_t>(block)|
+          static_cast<std::uintptr_t>(deep+1);
+        if( m_root.compare_exchange_strong(word, grown,
+            std::memory_order_acq_rel, std::memory_order_acquire) )
+          word = grown;
+        else
+          dlloc(block);
+      }
+      auto block = node_of(word);
+      for(auto lvl=deep_of(word); lvl>1; --lvl) {
+        block = static_cast<node*>(install(block[blk::jump(lvl, i)],
+          [this] { return static_cast<void*>(alloc_index()); },
+          [this](void* p) { dlloc(static_cast<node*>(p)); }));
+      }
+      auto elms = static_cast<Tp*>(install(block[blk::jump(1, i)],
+        [this, first] { return static_cast<void*>(alloc_val(first)); },
+        [this](void* p) { dlloc(static_cast<Tp*>(p)); }));
+      // the hint only moves forward
+      while( (last==nullptr || footer_of(last).first<first) &&
+          !m_last.compare_exchange_weak(last, elms,
+            std::memory_order_acq_rel, std::memory_order_acquire) ) {}
+      return elms;
+    }
+
+    // block of value of position i, null if not installed yet
+    Tp* find(size_type i) const noexcept {
+      auto word = m_root.load(std::memory_order_acquire);
+      if( word==0 || i>=end_size(deep_of(word)) )
+        return nullptr;
+      auto block = node_of(word);
+      for(auto lvl=deep_of(word); lvl>1 && block!=nullptr; --lvl)
+        block = static_cast<node*>(block[blk::jump(lvl, i)].
+          load(std::memory_order_acquire));
+      return block==nullptr ? nullptr : static_cast<Tp*>(
+        block[blk::jump(1, i)].load(std::memory_order_acquire));
+    }
+
+    /**
+     * @brief   Publish the element of slot i.
+     * 
+     * Marks the slot, then the producer whose slot ends the
+     * committed prefix advances it over the marked slots. All
+     * operations are sequentially consistent, so a producer which
+     * marks its slot after the scan of the advancer is seen by its
+     * rescan after the advance, and no slot is left behind.
+     */
+    void commit(Tp* elms, size_type i) noexcept {
+      auto j = blk::jump(0, i);
+      footer_of(elms).bits[j/word_bits].fetch_or(
+        word_type{1}<<(j%word_bits));
+      auto n = i;
+      if( m_size.load()!=n )
+        return;
+      for(;;) {
+        auto end = marked(elms, n);
+        if( end==n || !m_size.compare_exchange_strong(n, end) )
+          return;
+        n = end;
+      }
+    }
+
+    // end of the run of marked slots from n
+    size_type marked(Tp*& elms, size_type n) const noexcept {
+      for(;;) {
+        if( footer_of(elms).first!=(n&~static_cast<size_type>(
+            blk::mask())) ) {
+          auto next = find(n);
+          if( next==nullptr )
+            return n;
+          elms = next;
+        }
+        size_type j = blk::jump(0, n);
+        auto bits = footer_of(elms).bits[j/word_bits].load()>>
+          (j%word_bits);
+        auto run = static_cast<size_type>(std::countr_one(bits));
+        // the run goes on only past the end of word or block
+        if( run<std::min(word_bits-j%word_bits, blk::size()-j) )
+          return n+run;
+        n += run;
+      }
+    }
+
+    difference_type end_pos(void) const noexcept
+      { return static_cast<difference_type>(size()); }
+
+    const_pointer locate(difference_type index) const noexcept {
+      if( index<0 || static_cast<size_type>(index)>=size() )
+        return nullptr;
+      auto i = static_cast<size_type>(index);
+      return find(i)+blk::jump(0, i);
+    }
+
+    void release(node* block, mvlsize_type lvl, size_type base) noexcept {
+      auto n = size();
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        auto child = block[i].load(std::memory_order_relaxed);
+        if( child==nullptr )
+          continue;
+        auto first = base+(static_cast<size_type>(i)<<blk::shift(lvl));
+        if( lvl>1 ) {
+          release(static_cast<node*>(child), lvl-1, first);
+          continue;
+        }
+        auto elms = static_cast<Tp*>(child);
+        for(auto j=first; j<std::min<size_type>(n, first+blk::size()); ++j)
+          blk::val_traits::destroy(m_alloc, elms+(j-first));
+        dlloc(elms);
+      }
+      dlloc(block);
+    }
+};
+
+/**
+ * Double-ended multilevel vector.
+ * 
+ * The elements take the positions [m_head, m_head+m_size) of the
+ * tree, so both ends grow and shrink by whole blocks of value and
+ * only the blocks which hold elements are allocated. A root which
+ * has no room left on one side is put under a taller root, at its
+ * first child for the back and at its last child for the front,
+ * and a root whose elements all went into one child is replaced
+ * by that child, so the height stays O(log n) for a queue which
+ * runs forever. The emptied block of value is kept as the spare
+ * for the next new block, so an end which goes back and forth
+ * over a block boundary doesn't reach the allocator.
+ * 
+ * The copy-on-write, the block pool and the block cache of the
+ * traits are not used.
+ */
+template <std::uint8_t Exp, class Tp, class Traits = mvtraits,
+  class Alloc = std::allocator<Tp>>
+class rdmv {
+  static_assert(!Traits::cow && Traits::pool_slab==0,
+    "double-ended vector takes blocks from the allocator only");
+
+  private:
+    using blk = mvb<Exp, Tp, Traits, Alloc>;
+    using alloc_traits = std::allocator_traits<Alloc>;
+    using val_traits = typename blk::val_traits;
+    using mvlsize_type = typename blk::mvlsize_type;
+    using mvbsize_type = typename blk::mvbsize_type;
+
+    union mvp {
+      Tp* val;
+      Tp** index;
+      Tp*** pindex;
+    };
+
+  public:
+    using value_type = typename blk::value_type;
+    using reference = typename blk::reference;
+    using const_reference = typename blk::const_reference;
+    using pointer = typename blk::pointer;
+    using const_pointer = typename blk::const_pointer;
+    using size_type = typename blk::size_type;
+    using difference_type = typename blk::difference_type;
+    using allocator_type = Alloc;
+    using traits_type = Traits;
+    using iterator = rmvi<rdmv>;
+    using const_iterator = rmvci<rdmv>;
+    using reverse_iterator = std::reverse_iterator<iterator>;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+
+    friend iterator;
+    friend const_iterator;
+
+  private:
+    mvp m_root;
+    // position of the first element in the tree
+    size_type m_head;
+    size_type m_size;
+    mvlsize_type m_deep;
+    // blocks of value of the first and the last element
+    Tp* m_first;
+    Tp* m_last;
+    Tp* m_spare;
+    [[no_unique_address]] mutable mvrecord<> m_stats;
+    [[no_unique_address]] typename blk::val_alloc m_alloc;
+
+  public:
+    rdmv(void) noexcept(noexcept(Alloc())) : rdmv{Alloc()} {}
+    explicit rdmv(const Alloc& alloc) noexcept :
+      m_root{}, m_head{}, m_size{}, m_deep{}, m_first{}, m_last{},
+      m_spare{}, m_alloc(alloc) {}
+
+    rdmv(const rdmv& other) : rdmv{alloc_traits::
+      select_on_container_copy_construction(other.get_allocator())}
+      { copy_from(other); }
+    rdmv(rdmv&& other) noexcept : rdmv{Alloc(other.m_alloc)}
+      { steal(other); }
+
+    ~rdmv(void) noexcept(std::is_nothrow_destructible_v<Tp>) {
+      clear();
+      dlloc_spare();
+    }
+
+    rdmv& operator=(const rdmv& other) {
+      if( this==&other )
+        return *this;
+      clear();
+      if constexpr( alloc_traits::
+          propagate_on_container_copy_assignment::value ) {
+        dlloc_spare();
+        m_alloc = other.m_alloc;
+      }
+      copy_from(other);
+      return *this;
+    }
+
+    rdmv& operator=(rdmv&& other)
+      noexcept(alloc_traits::is_always_equal::value ||
+        alloc_traits::propagate_on_container_move_assignment::value) {
+      if( this==&other )
+        return *this;
+      clear();
+      if constexpr( alloc_traits::
+          propagate_on_container_move_assignment::value ) {
+        dlloc_spare();
+        m_alloc = other.m_alloc;
+      }
+      if( m_alloc==other.m_alloc )
+        steal(other);
+      else {
+        for(auto& elm : other)
+          emplace_back(std::move(elm));
+        other.clear();
+      }
+      return *this;
+    }
+
+    void swap(rdmv& other) noexcept {
+      if constexpr( alloc_traits::propagate_on_container_swap::value )
+        std::swap(m_alloc, other.m_alloc);
+      std::swap(m_root, other.m_root);
+      std::swap(m_head, other.m_head);
+      std::swap(m_size, other.m_size);
+      std::swap(m_deep, other.m_deep);
+      std::swap(m_first, other.m_first);
+      std::swap(m_last, other.m_last);
+      std::swap(m_spare, other.m_spare);
+    }
+    friend void swap(rdmv& a, rdmv& b) noexcept { a.swap(b); }
+
+    allocator_type get_allocator(void) const noexcept
+      { return allocator_type(m_alloc); }
+
+    void clear(void) noexcept(std::is_nothrow_destructible_v<Tp>) {
+      if( m_size==0 )
+        return;
+      for(auto& elm : *this)
+        val_traits::destroy(m_alloc, &elm);
+      release(m_root, m_deep);
+      m_root = {};
+      m_head = m_size = m_deep = 0;
+      m_first = m_last = nullptr;
+    }
+
+    template <class... Args>
+    reference emplace_back(Args&&... args) {
+      auto p = m_head+m_size;
+      auto block = m_last;
+      if( m_size==0 ) {
+        block = start(0);
+        p = 0;
+      } else if( blk::jump(0, p)==0 ) {
+        if( p==end_size(m_deep) )
+          raise(0);
+        block = make_block(p);
+      }
+      try {
+        val_traits::construct(m_alloc, block+blk::jump(0, p),
+          std::forward<Args>(args)...);
+      } catch(...) {
+        if( block!=m_last )
+          drop_block(p);
+        throw;
+      }
+      m_last = block;
+      if( m_size++==0 )
+        m_first = block;
+      return block[blk::jump(0, p)];
+    }
+
+    template <class... Args>
+    reference emplace_front(Args&&... args) {
+      auto block = m_first;
+      if( m_size==0 )
+        block = start(blk::size());
+      else if( blk::jump(0, m_head)==0 ) {
+        if( m_head==0 )
+          raise(blk::imask());
+        block = make_block(m_head-1);
+      }
+      auto p = m_head-1;
+      try {
+        val_traits::construct(m_alloc, block+blk::jump(0, p),
+          std::forward<Args>(args)...);
+      } catch(...) {
+        if( block!=m_first )
+          drop_block(p);
+        throw;
+      }
+      m_first = block;
+      --m_head;
+      if( m_size++==0 )
+        m_last = block;
+      return block[blk::jump(0, p)];
+    }
+
+    void push_back(const Tp& val) { emplace_back(val); }
+    void push_back(Tp&& val) { emplace_back(std::move(val)); }
+    void push_front(const Tp& val) { emplace_front(val); }
+    void push_front(Tp&& val) { emplace_front(std::move(val)); }
+
+    void pop_back(void) noexcept(std::is_nothrow_destructible_v<Tp>) {
+      auto p = m_head+(--m_size);
+      val_traits::destroy(m_alloc, m_last+blk::jump(0, p));
+      if( m_size==0 ) {
+        clear_blocks(p);
+        return;
+      }
+      if( blk::jump(0, p)!=0 )
+        return;
+      drop_block(p);
+      m_last = rand_block(m_head+m_size-1);
+    }
+
+    void pop_front(void) noexcept(std::is_nothrow_destructible_v<Tp>) {
+      auto p = m_head++;
+      --m_size;
+      val_traits::destroy(m_alloc, m_first+blk::jump(0, p));
+      if( m_size==0 ) {
+        clear_blocks(p);
+        return;
+      }
+      if( blk::jump(0, m_head)!=0 )
+        return;
+      drop_block(p);
+      m_first = rand_block(m_head);
+    }
+
+    reference operator[](size_type index) noexcept {
+      auto p = m_head+index;
+      return rand_block(p)[blk::jump(0, p)];
+    }
+    const_reference operator[](size_type index) const noexcept {
+      auto p = m_head+index;
+      return rand_block(p)[blk::jump(0, p)];
+    }
+    reference front(void) noexcept
+      { return m_first[blk::jump(0, m_head)]; }
+    const_reference front(void) const noexcept
+      { return m_first[blk::jump(0, m_head)]; }
+    reference back(void) noexcept
+      { return m_last[blk::jump(0, m_head+m_size-1)]; }
+    const_reference back(void) const noexcept
+      { return m_last[blk::jump(0, m_head+m_size-1)]; }
+
+    bool empty(void) const noexcept
+      { return m_size==0; }
+    size_type size(void) const noexcept
+      { return m_size; }
+    static consteval size_type block_size(void) noexcept
+      { return blk::size(); }
+
+    /**
+     * @brief   Contiguous segment.
+     * 
+     * @param   index   Position of element
+     * 
+     * @return  Elements from index to the end of its block of
+     *          value, bounded by the size.
+     */
+    std::span<Tp> segment(size_type index) noexcept {
+      if( index>=m_size )
+        return {};
+      auto p = m_head+index;
+      return {locate(p), std::min<size_type>(
+        blk::size()-blk::jump(0, p), m_size-index)};
+    }
+    std::span<const Tp> segment(size_type index) const noexcept {
+      if( index>=m_size )
+        return {};
+      auto p = m_head+index;
+      return {locate(p), std::min<size_type>(
+        blk::size()-blk::jump(0, p), m_size-index)};
+    }
+
+    mvstats stats(void) const noexcept { return m_stats.get(); }
+    void reset_stats(void) noexcept { m_stats.reset(); }
+
+    // only the blocks between the first and the last element are
+    // allocated, the spare block counts as a block of value
+    mvmemory memory_stats(void) const noexcept {
+      mvmemory mem{};
+      mem.leaf_blocks = m_spare!=nullptr;
+      if( m_size!=0 ) {
+        auto last = m_head+m_size-1;
+        for(mvlsize_type lvl=1; lvl<=m_deep; ++lvl)
+          mem.index_blocks += (last>>blk::shift(lvl+1))-
+            (m_head>>blk::shift(lvl+1))+1;
+        mem.leaf_blocks += (last>>Exp)-(m_head>>Exp)+1;
+      }
+      mem.leaf_bytes = sizeof(Tp)*blk::size()*mem.leaf_blocks;
+      mem.index_bytes = sizeof(Tp*)*blk::isize()*mem.index_blocks;
+      mem.slack_bytes = mem.leaf_bytes-sizeof(Tp)*m_size;
+      return mem;
+    }
+
+    iterator begin(void) noexcept
+      { return iterator(this, pos(m_head)); }
+    const_iterator begin(void) const noexcept
+      { return cbegin(); }
+    const_iterator cbegin(void) const noexcept
+      { return const_iterator(this, pos(m_head)); }
+    iterator end(void) noexcept
+      { return iterator(this, pos(m_head+m_size)); }
+    const_iterator end(void) const noexcept
+      { return cend(); }
+    const_iterator cend(void) const noexcept
+      { return const_iterator(this, pos(m_head+m_size)); }
+    reverse_iterator rbegin(void) noexcept
+      { return reverse_iterator(end()); }
+    const_reverse_iterator rbegin(void) const noexcept
+      { return crbegin(); }
+    const_reverse_iterator crbegin(void) const noexcept
+      { return const_reverse_iterator(cend()); }
+    reverse_iterator rend(void) noexcept
+      { return reverse_iterator(begin()); }
+    const_reverse_iterator rend(void) const noexcept
+      { return crend(); }
+    const_reverse_iterator crend(void) const noexcept
+      { return const_reverse_iterator(cbegin()); }
+
+  private:
+    static constexpr size_type
+      end_size(mvlsize_type deep) noexcept
+      { return static_cast<size_type>(1)<<blk::shift(deep+1); }
+    static constexpr difference_type pos(size_type p) noexcept
+      { return static_cast<difference_type>(p); }
+
+    // iterators hold the positions in the tree
+    difference_type end_pos(void) const noexcept
+      { return pos(m_head+m_size); }
+
+    Tp* alloc_val(void) {
+      if( m_spare!=nullptr )
+        return std::exchange(m_spare, nullptr);
+      auto block = blk::val::alloc(m_alloc);
+      m_stats.add(&mvstats::leaf_allocs);
+      return block;
+    }
+
+    Tp** alloc_index(void) {
+      auto block = blk::index::alloc(m_alloc);
+      m_stats.add(&mvstats::index_allocs);
+      return block;
+    }
+
+    // the block of value becomes the spare, if there is none
+    void dlloc(Tp* block) noexcept {
+      if( m_spare==nullptr ) {
+        m_spare = block;
+        return;
+      }
+      blk::val::dlloc(m_alloc, block);
+      m_stats.add(&mvstats::leaf_frees);
+    }
+
+    void dlloc(Tp** block) noexcept {
+      blk::index::dlloc(m_alloc, block);
+      m_stats.add(&mvstats::index_frees);
+    }
+
+    void dlloc_spare(void) noexcept {
+      if( m_spare==nullptr )
+        return;
+      blk::val::dlloc(m_alloc, std::exchange(m_spare, nullptr));
+      m_stats.add(&mvstats::leaf_frees);
+    }
+
+    Tp* rand_block(size_type p) const noexcept {
+      m_stats.add(&mvstats::descents);
+      auto block = m_root;
+      blk::descend(m_deep, [&block, p](auto lvl) noexcept
+        { block.index = block.pindex[blk::jump(lvl, p)]; });
+      return block.val;
+    }
+
+    // position in the tree, nullptr outside of the blocks
+    pointer locate(difference_type index) const noexcept {
+      auto b = static_cast<size_type>(index)>>Exp;
+      if( index<0 || m_size==0 || b<(m_head>>Exp) ||
+          b>((m_head+m_size-1)>>Exp) )
+        return nullptr;
+      auto p = static_cast<size_type>(index);
+      return rand_block(p)+blk::jump(0, p);
+    }
+
+    // root of the first element, the head is set to p
+    Tp* start(size_type p) {
+      m_root.val = alloc_val();
+      m_head = p;
+      return m_root.val;
+    }
+
+    // put the root under a taller root, at the child slot
+    void raise(mvbsize_type slot) {
+      auto block = m_root;
+      m_root.index = alloc_index();
+      m_root.pindex[slot] = block.index;
+      m_head += static_cast<size_type>(slot)<<blk::shift(m_deep+1);
+      ++m_deep;
+      m_stats.add(&mvstats::grows);
+    }
+
+    // replace the root by its child while it holds all elements
+    void collapse(void) noexcept {
+      auto last = m_head+m_size-1;
+      while( m_deep!=0 ) {
+        auto slot = m_head>>blk::shift(m_deep);
+        if( (last>>blk::shift(m_deep))!=slot )
+          return;
+        auto block = m_root;
+        m_root.index = block.pindex[slot];
+        dlloc(block.index);
+        m_head -= slot<<blk::shift(m_deep);
+        last -= slot<<blk::shift(m_deep);
+        --m_deep;
+        m_stats.add(&mvstats::shrinks);
+      }
+    }
+
+    // alloc the missing blocks on the path of position p
+    Tp* make_block(size_type p) {
+      auto block = m_root;
+      try {
+        for(auto lvl=m_deep; lvl>1; --lvl) {
+          auto& child = block.pindex[blk::jump(lvl, p)];
+          if( child==nullptr )
+            child = alloc_index();
+          block.index = child;
+        }
+        return block.index[blk::jump(1, p)] = alloc_val();
+      } catch(...) {
+        drop_block(p);
+        throw;
+      }
+    }
+
+    /**
+     * @brief   Drop block.
+     * 
+     * Deallocates the blocks on the path of position p which hold
+     * no element anymore, p must be outside of the elements.
+     * 
+     * @param   p   Position in the tree
+     */
+    void drop_block(size_type p) noexcept {
+      if( m_size==0 ) {
+        clear_blocks(p);
+        return;
+      }
+      // the highest subtree below the root without elements
+      auto last = m_head+m_size-1;
+      auto lvl = m_deep;
+      while( --lvl>0 ) {
+        auto s = blk::shift(lvl+1);
+        if( (p>>s)<(m_head>>s) || (p>>s)>(last>>s) )
+          break;
+      }
+      auto block = m_root;
+      for(auto i=m_deep; i>lvl+1; --i)
+        block.index = block.pindex[blk::jump(i, p)];
+      auto& child = block.pindex[blk::jump(lvl+1, p)];
+      release_path({.index=child}, lvl, p);
+      child = nullptr;
+      collapse();
+    }
+
+    // dealloc the blocks on the path of p, lvl is the level of root
+    void release_path(mvp root, mvlsize_type lvl, size_type p) noexcept {
+      if( root.val==nullptr )
+        return;
+      if( lvl==0 ) {
+        dlloc(root.val);
+        return;
+      }
+      release_path({.index=root.pindex[blk::jump(lvl, p)]}, lvl-1, p);
+      dlloc(root.index);
+    }
+
+    // dealloc the blocks after the last element is destroyed
+    void clear_blocks(size_type p) noexcept {
+      release_path(m_root, m_deep, p);
+      m_root = {};
+      m_head = m_deep = 0;
+      m_first = m_last = nullptr;
+    }
+
+    // dealloc the blocks of a subtree, lvl is the level of root
+    void release(mvp root, mvlsize_type lvl) noexcept {
+      if( lvl==0 ) {
+        dlloc(root.val);
+        return;
+      }
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        if( root.pindex[i]!=nullptr )
+          release({.index=root.pindex[i]}, lvl-1);
+      }
+      dlloc(root.index);
+    }
+
+    void copy_from(const rdmv& other) {
+      try {
+        for(auto& elm : other)
+          emplace_back(elm);
+      } catch(...) {
+        clear();
+        throw;
+      }
+    }
+
+    // this vector must be empty
+    void steal(rdmv& other) noexcept {
+      m_root = std::exchange(other.m_root, {});
+      m_head = std::exchange(other.m_head, 0);
+      m_size = std::exchange(other.m_size, 0);
+      m_deep = std::exchange(other.m_deep, 0);
+      m_first = std::exchange(other.m_first, nullptr);
+      m_last = std::exchange(other.m_last, nullptr);
+    }
+};
+
+/**
+ * Sparse multilevel vector.
+ * 
+ * resize() only records the size, a block of value and the blocks
+ * of index on its path are allocated by the first write into the
+ * block, every element of a new block starts as a copy of the
+ * default value. Reads of a hole return the default value, which
+ * is shared by all of them, and walks skip the holes by whole
+ * blocks.
+ * 
+ * The copy-on-write, the block pool and the block cache of the
+ * traits are not used.
+ */
+template <std::uint8_t Exp, class Tp, class Traits = mvtraits,
+  class Alloc = std::allocator<Tp>>
+class rsmv {
+  static_assert(!Traits::cow && Traits::pool_slab==0,
+    "sparse vector takes blocks from the allocator only");
+
+  private:
+    using blk = mvb<Exp, Tp, Traits, Alloc>;
+    using alloc_traits = std::allocator_traits<Alloc>;
+    using val_traits = typename blk::val_traits;
+    using mvlsize_type = typename blk::mvlsize_type;
+    using mvbsize_type = typename blk::mvbsize_type;
+
+    union mvp {
+      Tp* val;
+      Tp** index;
+      Tp*** pindex;
+    };
+
+  public:
+    using value_type = typename blk::value_type;
+    using reference = typename blk::reference;
+    using const_reference = typename blk::const_reference;
+    using pointer = typename blk::pointer;
+    using const_pointer = typename blk::const_pointer;
+    using size_type = typename blk::size_type;
+    using difference_type = typename blk::difference_type;
+    using allocator_type = Alloc;
+    using traits_type = Traits;
+
+  private:
+    mvp m_root;
+    size_type m_size;
+    mvlsize_type m_deep;
+    [[no_unique_address]] mutable mvrecord<> m_stats;
+    [[no_unique_address]] typename blk::val_alloc m_alloc;
+    Tp m_default;
+
+  public:
+    rsmv(void) : rsmv{Alloc()} {}
+    explicit rsmv(const Alloc& alloc) :
+      m_root{}, m_size{}, m_deep{}, m_alloc(alloc), m_default() {}
+    rsmv(size_type num, const Tp& val = Tp(),
+      const Alloc& alloc = Alloc()) :
+      m_root{}, m_size{}, m_deep{}, m_alloc(alloc), m_default(val)
+      { resize(num); }
+
+    rsmv(const rsmv& other) :
+      m_root{}, m_size{}, m_deep{},
+      m_alloc(alloc_traits::select_on_container_copy_construction(
+        other.get_allocator())),
+      m_default(other.m_default) { copy_from(other); }
+    rsmv(rsmv&& other) noexcept(
+      std::is_nothrow_move_constructible_v<Tp>) :
+      m_root{std::exchange(other.m_root, {})},
+      m_size{std::exchange(other.m_size, 0)},
+      m_deep{std::exchange(other.m_deep, 0)},
+      m_alloc(other.m_alloc), m_default(std::move(other.m_default)) {}
+
+    ~rsmv(void) noexcept(std::is_nothrow_destructible_v<Tp>)
+      { clear(); }
+
+    rsmv& operator=(const rsmv& other) {
+      if( this==&other )
+        return *this;
+      clear();
+      if constexpr( alloc_traits::
+          propagate_on_container_copy_assignment::value )
+        m_alloc = other.m_alloc;
+      m_default = other.m_default;
+      copy_from(other);
+      return *this;
+    }
+
+    rsmv& operator=(rsmv&& other) {
+      if( this==&other )
+        return *this;
+      clear();
+      if constexpr( alloc_traits::
+          propagate_on_container_move_assignment::value )
+        m_alloc = other.m_alloc;
+      m_default = std::move(other.m_default);
+      if( m_alloc==other.m_alloc ) {
+        m_root = std::exchange(other.m_root, {});
+        m_size = std::exchange(other.m_size, 0);
+        m_deep = std::exchange(other.m_deep, 0);
+      } else {
+        copy_from(other);
+        other.clear();
+      }
+      return *this;
+    }
+
+    void swap(rsmv& other) noexcept(std::is_nothrow_swappable_v<Tp>) {
+      if constexpr( alloc_traits::propagate_on_container_swap::value )
+        std::swap(m_alloc, other.m_alloc);
+      std::swap(m_root, other.m_root);
+      std::swap(m_size, other.m_size);
+      std::swap(m_deep, other.m_deep);
+      std::swap(m_default, other.m_default);
+    }
+    friend void swap(rsmv& a, rsmv& b) noexcept(noexcept(a.swap(b)))
+      { a.swap(b); }
+
+    allocator_type get_allocator(void) const noexcept
+      { return allocator_type(m_alloc); }
+
+    void clear(void) noexcept(std::is_nothrow_destructible_v<Tp>) {
+      if( m_root.val!=nullptr )
+        release(m_root, m_deep);
+      m_root = {};
+      m_size = m_deep = 0;
+    }
+
+    /**
+     * @brief   Resize.
+     * 
+     * Growing only raises the height of the allocated tree,
+     * shrinking deallocates the blocks past n and resets the rest
+     * of the last block to the default value.
+     * 
+     * @param   n   Num of elements
+     */
+    void resize(size_type n) {
+      auto deep = height(n);
+      if( n<m_size && m_root.val!=nullptr &&
+          trim(m_root, m_deep, 0, n) )
+        m_root = {};
+      if( n<m_size ) {
+        // the root keeps its first child only
+        for(; m_deep>deep; --m_deep) {
+          auto block = m_root;
+          if( block.val!=nullptr ) {
+            m_root.index = block.pindex[0];
+            dlloc(block.index);
+          }
+          m_stats.add(&mvstats::shrinks);
+        }
+      }
+      for(; m_deep<deep; ++m_deep) {
+        if( m_root.val!=nullptr ) {
+          auto block = m_root;
+          m_root.index = alloc_index();
+          m_root.pindex[0] = block.index;
+        }
+        m_stats.add(&mvstats::grows);
+      }
+      m_size = n;
+    }
+
+    // reads never allocate, a hole or a position past the size
+    // reads as the default value
+    const_reference operator[](size_type index) const noexcept {
+      auto block = find_block(index);
+      return block==nullptr ? m_default :
+        block[blk::jump(0, index)];
+    }
+    const_reference get(size_type index) const noexcept
+      { return (*this)[index]; }
+
+    /**
+     * @brief   Writable element.
+     * 
+     * Allocates the block of index if it is a hole. A position
+     * past the size grows the vector to index+1 first, as of
+     * resize(), so the tree is tall enough to hold it.
+     * 
+     * @param   index   Position of element
+     */
+    reference ref(size_type index) {
+      if( index>=m_size )
+        resize(index+1);
+      return write_block(index)[blk::jump(0, index)];
+    }
+    void set(size_type index, const Tp& val)
+      { ref(index) = val; }
+    void set(size_type index, Tp&& val)
+      { ref(index) = std::move(val); }
+
+    // the block of index is allocated
+    bool contains(size_type index) const noexcept
+      { return find_block(index)!=nullptr; }
+
+    const_reference default_value(void) const noexcept
+      { return m_default; }
+    bool empty(void) const noexcept
+      { return m_size==0; }
+    size_type size(void) const noexcept
+      { return m_size; }
+    static consteval size_type block_size(void) noexcept
+      { return blk::size(); }
+
+    /**
+     * @brief   Walk the allocated blocks.
+     * 
+     * @param   fn   Called for the elements of each allocated
+     *               block of value, bounded by the size,
+     *               fn(segment, position of its first element)
+     */
+    template <class Fn>
+    void for_segments(Fn fn) {
+      auto seg = [&fn](Tp* elm, size_type n, size_type base)
+        { fn(std::span<Tp>(elm, n), base); };
+      if( m_root.val!=nullptr )
+        walk(m_root, m_deep, 0, seg);
+    }
+    template <class Fn>
+    void for_segments(Fn fn) const {
+      auto seg = [&fn](const Tp* elm, size_type n, size_type base)
+        { fn(std::span<const Tp>(elm, n), base); };
+      if( m_root.val!=nullptr )
+        walk(m_root, m_deep, 0, seg);
+    }
+
+    mvstats stats(void) const noexcept { return m_stats.get(); }
+    void reset_stats(void) noexcept { m_stats.reset(); }
+
+    // the allocated blocks are counted by a walk of the tree
+    mvmemory memory_stats(void) const noexcept {
+      mvmemory mem{};
+      if( m_root.val!=nullptr )
+        count(m_root, m_deep, mem);
+      mem.leaf_bytes = sizeof(Tp)*blk::size()*mem.leaf_blocks;
+      mem.index_bytes = sizeof(Tp*)*blk::isize()*mem.index_blocks;
+      return mem;
+    }
+
+  private:
+    static constexpr size_type
+      end_size(mvlsize_type deep) noexcept
+      { return static_cast<size_type>(1)<<blk::shift(deep+1); }
+
+    // least height which holds n elements
+    static mvlsize_type height(size_type n) noexcept {
+      mvlsize_type deep = 0;
+      while( end_size(deep)<n )
+        ++deep;
+      return deep;
+    }
+
+    // block of value filled with the default value
+    Tp* alloc_val(void) {
+      auto block = blk::val::alloc(m_alloc);
+      mvbsize_type i = 0;
+      try {
+        for(; i<blk::size(); ++i)
+          val_traits::construct(m_alloc, block+i, m_default);
+      } catch(...) {
+        while( i!=0 )
+          val_traits::destroy(m_alloc, block+(--i));
+        blk::val::dlloc(m_alloc, block);
+        throw;
+      }
+      m_stats.add(&mvstats::leaf_allocs);
+      return block;
+    }
+
+    Tp** alloc_index(void) {
+      auto block = blk::index::alloc(m_alloc);
+      m_stats.add(&mvstats::index_allocs);
+      return block;
+    }
+
+    void dlloc(Tp* block) noexcept(std::is_nothrow_destructible_v<Tp>) {
+      for(mvbsize_type i=0; i<blk::size(); ++i)
+        val_traits::destroy(m_alloc, block+i);
+      blk::val::dlloc(m_alloc, block);
+      m_stats.add(&mvstats::leaf_frees);
+    }
+
+    void dlloc(Tp** block) noexcept {
+      blk::index::dlloc(m_alloc, block);
+      m_stats.add(&mvstats::index_frees);
+    }
+
+    Tp* find_block(size_type i) const noexcept {
+      // past the size, the path would wrap onto another position
+      if( i>=m_size )
+        return nullptr;
+      m_stats.add(&mvstats::descents);
+      auto block = m_root;
+      for(auto lvl=m_deep; lvl>0 && block.val!=nullptr; --lvl)
+        block.index = block.pindex[blk::jump(lvl, i)];
+      return block.val;
+    }
+
+    /**
+     * @brief   Writable block of value.
+     * 
+     * Allocates the missing blocks on the path of position i, a
+     * block of index allocated before a throw stays in the tree.
+     * 
+     * @param   i   Position of element
+     */
+    Tp* write_block(size_type i) {
+      m_stats.add(&mvstats::descents);
+      if( m_root.val==nullptr ) {
+        if( m_deep==0 )
+          m_root.val = alloc_val();
+        else
+          m_root.index = alloc_index();
+      }
+      if( m_deep==0 )
+        return m_root.val;
+      auto block = m_root;
+      for(auto lvl=m_deep; lvl>1; --lvl) {
+        auto& child = block.pindex[blk::jump(lvl, i)];
+        if( child==nullptr )
+          child = alloc_index();
+        block.index = child;
+      }
+      auto& leaf = block.index[blk::jump(1, i)];
+      if( leaf==nullptr )
+        leaf = alloc_val();
+      return leaf;
+    }
+
+    // dealloc a subtree, lvl is the level of root
+    void release(mvp root, mvlsize_type lvl)
+      noexcept(std::is_nothrow_destructible_v<Tp>) {
+      if( lvl==0 ) {
+        dlloc(root.val);
+        return;
+      }
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        if( root.pindex[i]!=nullptr )
+          release({.index=root.pindex[i]}, lvl-1);
+      }
+      dlloc(root.index);
+    }
+
+    /**
+     * @brief   Trim subtree.
+     * 
+     * @param   root   Root of subtree
+     * @param   lvl    Level of root
+     * @param   base   Position of the first element of root
+     * @param   n      Num of elements kept
+     * 
+     * @return  True if the root is released.
+     */
+    bool trim(mvp root, mvlsize_type lvl, size_type base,
+      size_type n) {
+      if( base>=n ) {
+        release(root, lvl);
+        return true;
+      }
+      if( lvl==0 ) {
+        std::fill(root.val+(n-base), root.val+std::min<size_type>(
+          blk::size(), m_size-base), m_default);
+        return false;
+      }
+      auto span = static_cast<size_type>(1)<<blk::shift(lvl);
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        auto first = base+i*span;
+        if( root.pindex[i]==nullptr || first+span<=n )
+          continue;
+        if( !trim({.index=root.pindex[i]}, lvl-1, first, n) )
+          continue;
+        if( lvl==1 )
+          root.index[i] = nullptr;
+        else
+          root.pindex[i] = nullptr;
+      }
+      return false;
+    }
+
+    template <class Fn>
+    void walk(mvp root, mvlsize_type lvl, size_type base,
+      Fn& fn) const {
+      if( base>=m_size )
+        return;
+      if( lvl==0 ) {
+        fn(root.val, std::min<size_type>(blk::size(), m_size-base),
+          base);
+        return;
+      }
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        if( root.pindex[i]!=nullptr )
+          walk({.index=root.pindex[i]}, lvl-1,
+            base+(static_cast<size_type>(i)<<blk::shift(lvl)), fn);
+      }
+    }
+
+    void count(mvp root, mvlsize_type lvl, mvmemory& mem)
+      const noexcept {
+      if( lvl==0 ) {
+        ++mem.leaf_blocks;
+        return;
+      }
+      ++mem.index_blocks;
+      for(mvbsize_type i=0; i<blk::isize(); ++i) {
+        if( root.pindex[i]!=nullptr )
+          count({.index=root.pindex[i]}, lvl-1, mem);
+      }
+    }
+
+    // this vector must be empty, the holes of other stay holes
+    void copy_from(const rsmv& other) {
+      try {
+        resize(other.m_size);
+        other.for_segments([this](std::span<const Tp> seg,
+          size_type base) {
+          std::copy(seg.begin(), seg.end(),
+            write_block(base)+blk::jump(0, base));
+        });
+      } catch(...) {
+        clear();
+        throw;
+      }
+    }
+};
+
+/**
+ * Parallel algorithms over the blocks of value.
+ * 
+ * The work is split along the blocks, each task takes whole
+ * blocks and a thread gets a run of neighbouring blocks, which
+ * share their subtrees. The blocks run on OpenMP if it is
+ * enabled, otherwise sequentially. The functions must not throw.
+ */
+namespace par {
+
+/**
+ * Segments of a vector, one for each block of value. The first one
+ * ends at the first boundary of block, which is short of
+ * block_size() when the elements don't start at a boundary, e.g.
+ * after push_front of rdmv, the others are whole blocks but the
+ * last.
+ */
+template <class V>
+struct segments {
+  using size_type = typename V::size_type;
+  static constexpr size_type bsize = V::block_size();
+
+  size_type head;
+  size_type count;
+
+  explicit segments(const V& v) noexcept :
+    head{v.empty() ? 0 : v.segment(0).size()},
+    count{head==0 ? 0 : 1+(v.size()-head+bsize-1)/bsize} {}
+
+  // position of the first element of segment b
+  size_type first(size_type b) const noexcept
+    { return b==0 ? 0 : head+(b-1)*bsize; }
+  // segment of position i
+  size_type of(size_type i) const noexcept
+    { return i<head ? 0 : (i-head)/bsize+1; }
+};
+
+/**
+ * @brief   Walk the blocks.
+ * 
+ * @param   v    Vector
+ * @param   fn   Called for the elements of each block of value,
+ *               fn(segment, position of its first element)
+ */
+template <class V, class Fn>
+void for_blocks(V& v, Fn fn) {
+  const segments<std::remove_const_t<V>> segs(v);
+  auto nblocks = static_cast<std::ptrdiff_t>(segs.count);
+  // clone the shared blocks first, the clone is not thread safe
+  if constexpr( !std::is_const_v<V> &&
+      std::remove_const_t<V>::traits_type::cow ) {
+    for(std::ptrdiff_t b=0; b<nblocks; ++b)
+      v.segment(segs.first(static_cast<std::size_t>(b)));
+  }
+  RSFR_RMV_OMP(omp parallel for schedule(static))
+  for(std::ptrdiff_t b=0; b<nblocks; ++b) {
+    auto i = segs.first(static_cast<std::size_t>(b));
+    fn(v.segment(i), i);
+  }
+}
+
+template <class V, class Fn>
+void for_each(V& v, Fn fn) {
+  for_blocks(v, [&fn](auto seg, auto) {
+    for(auto& elm : seg)
+      fn(elm);
+  });
+}
+
+// dst[i] = op(src[i]), dst must be as large as src
+template <class Src, class Dst, class Op>
+void transform(const Src& src, Dst& dst, Op op) {
+  for_blocks(dst, [&src, &op](auto seg, auto i) {
+    auto it = src.cbegin()+static_cast<std::ptrdiff_t>(i);
+    auto n = std::min<std::size_t>(seg.size(), src.size()-
+      std::min<std::size_t>(i, src.size()));
+    for(std::size_t j=0; j<n; ++j, ++it)
+      seg[j] = op(*it);
+  });
+}
+
+// v[i] = op(v[i])
+template <class V, class Op>
+void transform(V& v, Op op) {
+  for_blocks(v, [&op](auto seg, auto) {
+    for(auto& elm : seg)
+      elm = op(elm);
+  });
+}
+
+/**
+ * @brief   Reduce the elements.
+ * 
+ * Op must be associative and commutative, as of std::reduce.
+ * Each block is folded on its own, then the folds of blocks are
+ * combined in order.
+ */
+template <class V, class T, class Op = std::plus<>>
+T reduce(const V& v, T init, Op op = {}) {
+  const segments<V> segs(v);
+  std::vector<std::optional<T>> part(segs.count);
+  for_blocks(v, [&part, &op, &segs](auto seg, auto i) {
+    auto it = seg.begin();
+    T acc = *it;
+    for(++it; it!=seg.end(); ++it)
+      acc = op(std::move(acc), *it);
+    part[segs.of(i)].emplace(std::move(acc));
+  });
+  for(auto& acc : part)
+    init = op(std::move(init), std::move(*acc));
+  return init;
+}
+
+template <class V, class Pred>
+typename V::size_type count_if(const V& v, Pred pred) {
+  using size_type = typename V::size_type;
+  const segments<V> segs(v);
+  auto nblocks = static_cast<std::ptrdiff_t>(segs.count);
+  size_type count = 0;
+  RSFR_RMV_OMP(omp parallel for schedule(static) reduction(+:count))
+  for(std::ptrdiff_t b=0; b<nblocks; ++b) {
+    auto seg = v.segment(segs.first(static_cast<size_type>(b)));
+    for(auto& elm : seg)
+      count += static_cast<size_type>(pred(elm));
+  }
+  return count;
+}
+
+template <class V, class T>
+void fill(V& v, const T& val) {
+  for_blocks(v, [&val](auto seg, auto) {
+    std::fill(seg.begin(), seg.end(), val);
+  });
+}
+
+}
+
+/**
+ * @brief   Co-rank of merge path.
+ * 
+ * @return  Num of elements of a among the first k elements of the
+ *          stable merge of a[0, n) and b[0, m), ties take a first.
+ */
+template <class It, class Comp>
+std::size_t mvcorank(std::size_t k, It a, std::size_t n,
+  It b, std::size_t m, Comp& comp) {
+  auto lo = k>m ? k-m : 0;
+  auto hi = std::min(k, n);
+  while( lo<hi ) {
+    auto i = lo+(hi-lo)/2;
+    auto j = k-i;
+    auto ai = static_cast<std::ptrdiff_t>(i);
+    auto bj = static_cast<std::ptrdiff_t>(j);
+    if( j>0 && i<n && !comp(b[bj-1], a[ai]) )
+      lo = i+1;
+    else
+      hi = i;
+  }
+  return lo;
+}
+
+/**
+ * @brief   Merge sort of blocks.
+ * 
+ * Sorts each block of value in place, then merges runs of blocks
+ * pairwise, ping-ponging between the vector and one scratch
+ * vector of the same allocator. Each merge is cut along its merge
+ * path into tasks of similar size, so the last rounds keep all
+ * threads busy. Tp must be default constructible for scratch.
+ */
+template <class V, class Comp, class Sort>
+void mvmerge_sort(V& v, Comp comp, Sort sort) {
+  using size_type = typename V::size_type;
+  using diff = std::ptrdiff_t;
+  constexpr size_type bsize = V::block_size();
+  auto n = v.size();
+  par::for_blocks(v, [&comp, &sort](auto seg, auto) {
+    sort(seg.begin(), seg.end(), comp);
+  });
+  if( n<=bsize )
+    return;
+  V tmp(v.get_allocator());
+  tmp.fill(n);
+  auto src = &v;
+  auto dst = &tmp;
+  struct task {
+    size_type first, mid, last, k0, k1, i0, i1;
+  };
+  std::vector<task> tasks;
+  auto grain = std::max<size_type>(bsize, n/64);
+  for(size_type width=bsize; width<n; width*=2) {
+    tasks.clear();
+    for(size_type first=0; first<n; first+=2*width) {
+      auto mid = std::min(first+width, n);
+      auto last = std::min(first+2*width, n);
+      for(size_type k=0; k<last-first; k+=grain)
+        tasks.push_back({first, mid, last, k,
+          std::min(k+grain, last-first), 0, 0});
+    }
+    // the cuts are found before any element is moved from
+    RSFR_RMV_OMP(omp parallel for schedule(static))
+    for(diff t=0; t<static_cast<diff>(tasks.size()); ++t) {
+      auto& tk = tasks[static_cast<size_type>(t)];
+      auto a = src->cbegin()+static_cast<diff>(tk.first);
+      auto b = src->cbegin()+static_cast<diff>(tk.mid);
+      auto na = tk.mid-tk.first;
+      auto nb = tk.last-tk.mid;
+      tk.i0 = mvcorank(tk.k0, a, na, b, nb, comp);
+      tk.i1 = mvcorank(tk.k1, a, na, b, nb, comp);
+    }
+    RSFR_RMV_OMP(omp parallel for schedule(dynamic))
+    for(diff t=0; t<static_cast<diff>(tasks.size()); ++t) {
+      auto& tk = tasks[static_cast<size_type>(t)];
+      auto a = src->begin()+static_cast<diff>(tk.first);
+      auto b = src->begin()+static_cast<diff>(tk.mid);
+      std::merge(std::make_move_iterator(a+static_cast<diff>(tk.i0)),
+        std::make_move_iterator(a+static_cast<diff>(tk.i1)),
+        std::make_move_iterator(b+static_cast<diff>(tk.k0-tk.i0)),
+        std::make_move_iterator(b+static_cast<diff>(tk.k1-tk.i1)),
+        dst->begin()+static_cast<diff>(tk.first+tk.k0), comp);
+    }
+    std::swap(src, dst);
+  }
+  if( src!=&v )
+    v.swap(tmp);
+}
+
+/**
+ * @brief   Radix sort of integers.
+ * 
+ * LSD radix sort by bytes, stable. The vector is cut into tiles
+ * of whole blocks, each tile counts its digits and scatters its
+ * elements to the positions given by the prefix sums, in
+ * parallel. A pass is skipped if all elements share the digit.
+ */
+template <class V>
+void mvradix_sort(V& v) {
+  using Tp = typename V::value_type;
+  using U = std::make_unsigned_t<Tp>;
+  using size_type = typename V::size_type;
+  using diff = std::ptrdiff_t;
+  constexpr size_type bsize = V::block_size();
+  constexpr size_type radix = 256;
+  auto n = v.size();
+  if( n<2 )
+    return;
+  // unshares a copy-on-write vector before the parallel writes
+  par::for_blocks(v, [](auto, auto) {});
+  auto nblocks = (n+bsize-1)/bsize;
+  auto ntiles = std::min<size_type>(nblocks, 64);
+  V tmp(v.get_allocator());
+  tmp.fill(n);
+  auto src = &v;
+  auto dst = &tmp;
+  std::vector<size_type> hist(ntiles*radix);
+  auto tile = [&](size_type t) {
+    return std::pair<size_type, size_type>{t*nblocks/ntiles*bsize,
+      std::min((t+1)*nblocks/ntiles*bsize, n)};
+  };
+  for(size_type shift=0; shift<8*sizeof(Tp); shift+=8) {
+    // the sign bit is flipped, so negative integers come first
+    U flip = std::is_signed_v<Tp> && shift+8==8*sizeof(Tp) ?
+      static_cast<U>(U{1}<<(8*sizeof(Tp)-1)) : U{0};
+    auto digit = [shift, flip](const Tp& elm) {
+      return static_cast<size_type>(
+        static_cast<U>(static_cast<U>(elm)^flip)>>shift)&(radix-1);
+    };
+    std::fill(hist.begin(), hist.end(), 0);
+    RSFR_RMV_OMP(omp parallel for schedule(static))
+    for(diff t=0; t<static_cast<diff>(ntiles); ++t) {
+      auto cnt = hist.data()+static_cast<size_type>(t)*radix;
+      auto [first, last] = tile(static_cast<size_type>(t));
+      for(auto i=first; i<last; i+=bsize)
+        for(auto& elm : std::as_const(*src).segment(i))
+          ++cnt[digit(elm)];
+    }
+    // prefix sums, digit major, tile minor
+    size_type sum = 0;
+    bool skip = false;
+    for(size_type d=0; d<radix; ++d) {
+      size_type total = 0;
+      for(size_type t=0; t<ntiles; ++t) {
+        auto cnt = hist[t*radix+d];
+        hist[t*radix+d] = sum;
+        sum += cnt;
+        total += cnt;
+      }
+      skip = skip || total==n;
+    }
+    if( skip )
+      continue;
+    RSFR_RMV_OMP(omp parallel for schedule(static))
+    for(diff t=0; t<static_cast<diff>(ntiles); ++t) {
+      auto off = hist.data()+static_cast<size_type>(t)*radix;
+      typename V::iterator out[radix];
+      for(size_type d=0; d<radix; ++d)
+        out[d] = dst->begin()+static_cast<diff>(off[d]);
+      auto [first, last] = tile(static_cast<size_type>(t));
+      for(auto i=first; i<last; i+=bsize)
+        for(auto& elm : src->segment(i))
+          *out[digit(elm)]++ = std::move(elm);
+    }
+    std::swap(src, dst);
+  }
+  if( src!=&v )
+    v.swap(tmp);
+}
+
+/**
+ * @brief   Sort the vector.
+ * 
+ * Integers in ascending order take the radix sort, otherwise each
+ * block of value is sorted as a contiguous array and the blocks
+ * are merged, see mvmerge_sort().
+ */
+template <class V, class Comp>
+void sort(V& v, Comp comp) {
+  mvmerge_sort(v, comp, [](auto first, auto last, Comp& cmp) {
+    std::sort(first, last, cmp);
+  });
+}
+
+template <class V, class Comp>
+void stable_sort(V& v, Comp comp) {
+  mvmerge_sort(v, comp, [](auto first, auto last, Comp& cmp) {
+    std::stable_sort(first, last, cmp);
+  });
+}
+
+template <class Tp>
+inline constexpr bool mvradix =
+  std::is_integral_v<Tp> && !std::is_same_v<Tp, bool>;
+
+template <class V>
+void sort(V& v) {
+  if constexpr( mvradix<typename V::value_type> )
+    mvradix_sort(v);
+  else
+    sort(v, std::less<>{});
+}
+
+template <class V>
+void stable_sort(V& v) {
+  if constexpr( mvradix<typename V::value_type> )
+    mvradix_sort(v);
+  else
+    stable_sort(v, std::less<>{});
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && \
+  defined(__x86_64__) && defined(__ELF__)
+#define RSFR_RMV_SIMD \
+  [[gnu::target_clones("arch=x86-64-v4", "arch=x86-64-v3", "default")]]
+#else
+#define RSFR_RMV_SIMD
+#endif
+
+/**
+ * Kernels over contiguous elements of arithmetic Tp.
+ * 
+ * The loops are kept simple enough to be vectorized, and GCC
+ * builds each of them for AVX-512, AVX2 and the baseline SSE2,
+ * picking one at load time by the CPU. Other compilers get the
+ * baseline build.
+ */
+template <class Tp>
+struct mvsimd {
+  static_assert(std::is_arithmetic_v<Tp>,
+    "kernels need arithmetic elements");
+
+  // integers are summed in 64 bits
+  using sum_type = std::conditional_t<std::is_floating_point_v<Tp>,
+    Tp, std::conditional_t<std::is_signed_v<Tp>,
+      std::int64_t, std::uint64_t>>;
+
+  // num of elements tested at once before the exact position
+  static constexpr std::size_t chunk = 64;
+
+  RSFR_RMV_SIMD
+  static std::size_t count(const Tp* elm, std::size_t n,
+    Tp val) noexcept {
+    std::size_t cnt = 0;
+    for(std::size_t i=0; i<n; ++i)
+      cnt += elm[i]==val;
+    return cnt;
+  }
+
+  // return n if not found
+  RSFR_RMV_SIMD
+  static std::size_t find(const Tp* elm, std::size_t n,
+    Tp val) noexcept {
+    std::size_t i = 0;
+    for(; i+chunk<=n; i+=chunk) {
+      bool hit = false;
+      for(std::size_t j=0; j<chunk; ++j)
+        hit |= elm[i+j]==val;
+      if( hit )
+        break;
+    }
+    for(; i<n; ++i)
+      if( elm[i]==val )
+        return i;
+    return n;
+  }
+
+  RSFR_RMV_SIMD
+  static Tp min(const Tp* elm, std::size_t n, Tp acc) noexcept {
+    for(std::size_t i=0; i<n; ++i)
+      acc = elm[i]<acc ? elm[i] : acc;
+    return acc;
+  }
+
+  RSFR_RMV_SIMD
+  static Tp max(const Tp* elm, std::size_t n, Tp acc) noexcept {
+    for(std::size_t i=0; i<n; ++i)
+      acc = elm[i]>acc ? elm[i] : acc;
+    return acc;
+  }
+
+  // floating point is summed in 8 lanes, the order differs
+  // from a sequential sum
+  RSFR_RMV_SIMD
+  static sum_type sum(const Tp* elm, std::size_t n) noexcept {
+    sum_type acc[8] = {};
+    std::size_t i = 0;
+    for(; i+8<=n; i+=8)
+      for(std::size_t j=0; j<8; ++j)
+        acc[j] += static_cast<sum_type>(elm[i+j]);
+    for(; i<n; ++i)
+      acc[0] += static_cast<sum_type>(elm[i]);
+    return ((acc[0]+acc[1])+(acc[2]+acc[3]))+
+      ((acc[4]+acc[5])+(acc[6]+acc[7]));
+  }
+};
+
+/**
+ * Search and aggregation over the blocks of value, block by block
+ * with the kernels of mvsimd, the tree is descended once a block.
+ */
+namespace simd {
+
+// walk the segments until fn returns false
+template <class V, class Fn>
+void for_segments(const V& v, Fn fn) {
+  for(typename V::size_type i=0; i<v.size();) {
+    auto seg = v.segment(i);
+    if( !fn(seg.data(), seg.size(), i) )
+      return;
+    i += seg.size();
+  }
+}
+
+template <class V>
+auto find(const V& v, const typename V::value_type& val) {
+  using Tp = typename V::value_type;
+  auto pos = v.size();
+  for_segments(v, [&](const Tp* elm, std::size_t n, std::size_t i) {
+    auto j = mvsimd<Tp>::find(elm, n, val);
+    if( j==n )
+      return true;
+    pos = i+j;
+    return false;
+  });
+  return v.cbegin()+static_cast<std::ptrdiff_t>(pos);
+}
+
+template <class V>
+bool contains(const V& v, const typename V::value_type& val)
+  { return find(v, val)!=v.end(); }
+
+template <class V>
+typename V::size_type count(const V& v,
+  const typename V::value_type& val) {
+  using Tp = typename V::value_type;
+  typename V::size_type cnt = 0;
+  for_segments(v, [&](const Tp* elm, std::size_t n, std::size_t) {
+    cnt += mvsimd<Tp>::count(elm, n, val);
+    return true;
+  });
+  return cnt;
+}
+
+// the vector must not be empty
+template <class V>
+typename V::value_type min(const V& v) {
+  using Tp = typename V::value_type;
+  auto acc = v.front();
+  for_segments(v, [&](const Tp* elm, std::size_t n, std::size_t) {
+    acc = mvsimd<Tp>::min(elm, n, acc);
+    return true;
+  });
+  return acc;
+}
+
+// the vector must not be empty
+template <class V>
+typename V::value_type max(const V& v) {
+  using Tp = typename V::value_type;
+  auto acc = v.front();
+  for_segments(v, [&](const Tp* elm, std::size_t n, std::size_t) {
+    acc = mvsimd<Tp>::max(elm, n, acc);
+    return true;
+  });
+  return acc;
+}
+
+template <class V>
+auto sum(const V& v) {
+  using Tp = typename V::value_type;
+  typename mvsimd<Tp>::sum_type acc{};
+  for_segments(v, [&](const Tp* elm, std::size_t n, std::size_t) {
+    acc += mvsimd<Tp>::sum(elm, n);
+    return true;
+  });
+  return acc;
+}
+
+}
+
+/**
+ * Vectors whose block of value fills a page, the exponent is
+ * derived from the size of Tp by leaf_exponent.
+ */
+template <class Tp, class Traits = mvtraits,
+  class Alloc = std::allocator<Tp>>
+using rpmv_auto = rpmv<leaf_exponent<Tp>, Tp, Traits, Alloc>;
+
+template <class Tp, class Traits = mvtraits,
+  class Alloc = std::allocator<Tp>>
+using rdmv_auto = rdmv<leaf_exponent<Tp>, Tp, Traits, Alloc>;
+
+template <class Tp, class Traits = mvtraits,
+  class Alloc = std::allocator<Tp>>
+using rsmv_auto = rsmv<leaf_exponent<Tp>, Tp, Traits, Alloc>;
+
+namespace pmr {
+
+template <std::uint8_t Exp, class Tp, class Traits = mvtraits>
+using rpmv = rsfr::rpmv<Exp, Tp, Traits,
+  std::pmr::polymorphic_allocator<Tp>>;
+
+template <std::uint8_t Exp, class Tp, class Traits = mvtraits>
+using rdmv = rsfr::rdmv<Exp, Tp, Traits,
+  std::pmr::polymorphic_allocator<Tp>>;
+
+template <std::uint8_t Exp, class Tp, class Traits = mvtraits>
+using rsmv = rsfr::rsmv<Exp, Tp, Traits,
+  std::pmr::polymorphic_allocator<Tp>>;
+
+template <class Tp, class Traits = mvtraits>
+using rpmv_auto = rpmv<leaf_exponent<Tp>, Tp, Traits>;
+
+template <class Tp, class Traits = mvtraits>
+using rdmv_auto = rdmv<leaf_exponent<Tp>, Tp, Traits>;
+
+template <class Tp, class Traits = mvtraits>
+using rsmv_auto = rsmv<leaf_exponent<Tp>, Tp, Traits>;
+
+}
+
 }
 
 #endif /* RSFR_RMV_H */